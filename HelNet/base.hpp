@@ -8,6 +8,7 @@ Copyright: (C) 2024 Mattis DALLEAU
 #include <map>
 #include <queue>
 #include <array>
+#include <vector>
 
 #include <hl/silva/collections/stdint.hpp>
 #include <hl/silva/collections/meta.hpp>
@@ -15,15 +16,21 @@ Copyright: (C) 2024 Mattis DALLEAU
 #include <limits>
 #include <atomic>
 #include <memory>
+#include <functional>
 
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ip/udp.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/smart_ptr/make_shared_object.hpp>
+
+#include "HelNet/buffer_pool.hpp"
 
 namespace hl
 {
 namespace net
 {
 
+// Capacity of the buffers the receives are done in (buffers given to send have their own length)
 #ifndef HL_NET_BUFFER_SIZE
     #define HL_NET_BUFFER_SIZE 1024
 #endif
@@ -56,7 +63,78 @@ static_assert(HL_NET_BUFFER_SIZE > 0, "HL_NET_BUFFER_SIZE must be greater than 0
 
     using port_t = u16;
 
-    using buffer_t = std::array<byte, HL_NET_BUFFER_SIZE>;
+    // Length aware byte buffer, its storage is a block of the smallest buffer_pool size class able to hold it
+    class buffer_t final
+    {
+    public:
+        using value_type = byte;
+        using iterator = byte *;
+        using const_iterator = const byte *;
+
+    private:
+        byte *m_data;
+        size_t m_size;
+        size_t m_capacity;
+
+        static size_t _capacity_for(const size_t size)
+        {
+            const size_t block_class = buffer_pool::size_class(size);
+            return block_class == buffer_pool::INVALID_CLASS ? size : buffer_pool::class_size(block_class);
+        }
+
+    public:
+        // the content is left uninitialized
+        explicit buffer_t(const size_t size = HL_NET_BUFFER_SIZE)
+            : m_data(nullptr)
+            , m_size(size)
+            , m_capacity(_capacity_for(size))
+        {
+            m_data = static_cast<byte *>(buffer_pool::instance().allocate(m_capacity));
+        }
+
+        ~buffer_t()
+        {
+            buffer_pool::instance().deallocate(m_data, m_capacity);
+        }
+
+        buffer_t(const buffer_t &) = delete;
+        buffer_t &operator=(const buffer_t &) = delete;
+
+        byte *data() { return m_data; }
+        const byte *data() const { return m_data; }
+
+        // length of the payload
+        size_t size() const { return m_size; }
+        // bytes usable without reallocating
+        size_t capacity() const { return m_capacity; }
+        bool empty() const { return m_size == 0; }
+
+        iterator begin() { return m_data; }
+        iterator end() { return m_data + m_size; }
+        const_iterator begin() const { return m_data; }
+        const_iterator end() const { return m_data + m_size; }
+
+        byte &operator[](const size_t index) { return m_data[index]; }
+        const byte &operator[](const size_t index) const { return m_data[index]; }
+
+        // grows the storage when needed (the payload is kept, the new bytes are uninitialized)
+        void resize(const size_t size)
+        {
+            if (size > m_capacity)
+            {
+                const size_t new_capacity = _capacity_for(size);
+                byte *new_data = static_cast<byte *>(buffer_pool::instance().allocate(new_capacity));
+                std::copy(m_data, m_data + m_size, new_data);
+                buffer_pool::instance().deallocate(m_data, m_capacity);
+                m_data = new_data;
+                m_capacity = new_capacity;
+            }
+            m_size = size;
+        }
+
+        void clear() { m_size = 0; }
+    };
+
     using shared_buffer_t = boost::shared_ptr<buffer_t>;
 
     using client_id_t = std::uint64_t;
@@ -68,7 +146,7 @@ static_assert(HL_NET_BUFFER_SIZE > 0, "HL_NET_BUFFER_SIZE must be greater than 0
     HL_NET_STATIC_CONSTEXPR port_t MAX_PORT = std::numeric_limits<port_t>::max();
     HL_NET_STATIC_CONSTEXPR port_t MIN_PORT = std::numeric_limits<port_t>::min();
 
-    using unhealthy_connexions_t = std::queue<client_id_t>;
+    using unhealthy_connexions_t = std::vector<client_id_t>;
 
     template<typename CallbackTypes>
     using callback_layer_register_t = std::map<std::string, CallbackTypes>;
@@ -84,38 +162,416 @@ static_assert(HL_NET_BUFFER_SIZE > 0, "HL_NET_BUFFER_SIZE must be greater than 0
     #define _HL_INTERNAL_LOCK_GUARD_WHEN_TRUE(CONDITION, LOCK_NAME, MUTEX, CODE) \
         do { HL_NET_IF_CONSTEXPR (CONDITION) { std::lock_guard<std::mutex> LOCK_NAME(MUTEX); CODE } else { CODE } } while (0)
 
-    static inline shared_buffer_t make_shared_buffer()
+    // buffer_t and its control block come from the buffer_pool, the payload is left uninitialized
+    static inline shared_buffer_t make_uninitialized_shared_buffer(const size_t size = HL_NET_BUFFER_SIZE)
     {
-        buffer_t *buffer = new buffer_t();
-        std::fill(buffer->begin(), buffer->end(), byte(0));
-        return shared_buffer_t(buffer);
+        return boost::allocate_shared<buffer_t>(buffer_pool_allocator<buffer_t>(), size);
     }
 
-    static inline shared_buffer_t make_shared_buffer(const byte *data, size_t size)
+    // zero filled buffer of `size` bytes
+    static inline shared_buffer_t make_shared_buffer(const size_t size = HL_NET_BUFFER_SIZE)
     {
-        shared_buffer_t shared_buffer(new buffer_t());
-        std::copy(data, data + std::min(size, shared_buffer->size()), shared_buffer->begin());
+        shared_buffer_t shared_buffer = make_uninitialized_shared_buffer(size);
+        std::fill(shared_buffer->begin(), shared_buffer->end(), byte(0));
         return shared_buffer;
     }
 
+    static inline shared_buffer_t make_shared_buffer(const byte *data, const size_t size)
+    {
+        shared_buffer_t shared_buffer = make_uninitialized_shared_buffer(size);
+        std::copy(data, data + size, shared_buffer->begin());
+        return shared_buffer;
+    }
+
+    static inline shared_buffer_t make_shared_buffer(const buffer_t &data, const size_t size)
+    {
+        return make_shared_buffer(data.data(), std::min(size, data.size()));
+    }
+
+    static inline shared_buffer_t make_shared_buffer(const buffer_t &data)
+    {
+        return make_shared_buffer(data.data(), data.size());
+    }
+
     static inline shared_buffer_t make_shared_buffer(const shared_buffer_t &data)
     {
-        return make_shared_buffer(data->data(), data->size());
+        return make_shared_buffer(*data);
     }
 
     static inline shared_buffer_t make_shared_buffer(const shared_buffer_t &data, const size_t size)
     {
-        return make_shared_buffer(data->data(), size);
+        return make_shared_buffer(*data, size);
     }
 
-    static inline shared_buffer_t make_shared_buffer(const buffer_t &data, const size_t size)
+    // pieces of a single message sent with one scatter-gather system call (writev/sendmsg)
+    using shared_buffer_sequence_t = std::vector<shared_buffer_t>;
+
+    // Keeps the pieces of a scatter-gather send alive until its completion
+    struct shared_buffer_sequence_holder final
     {
-        return make_shared_buffer(data.data(), size);
+        shared_buffer_sequence_t buffers;
+        std::vector<boost::asio::const_buffer> views;
+        size_t size;
+
+        explicit shared_buffer_sequence_holder(const shared_buffer_sequence_t &pieces)
+            : buffers(pieces)
+            , views()
+            , size(0)
+        {
+            views.reserve(buffers.size());
+            for (const shared_buffer_t &buffer : buffers)
+            {
+                views.emplace_back(buffer->data(), buffer->size());
+                size += buffer->size();
+            }
+        }
+    };
+
+    using shared_buffer_sequence_holder_t = boost::shared_ptr<const shared_buffer_sequence_holder>;
+
+    // nullptr when one of the pieces is a null buffer
+    static inline shared_buffer_sequence_holder_t make_shared_buffer_sequence_holder(const shared_buffer_sequence_t &buffers)
+    {
+        for (const shared_buffer_t &buffer : buffers)
+        {
+            if (!buffer)
+            {
+                return nullptr;
+            }
+        }
+        return boost::allocate_shared<shared_buffer_sequence_holder>(buffer_pool_allocator<shared_buffer_sequence_holder>(), buffers);
     }
 
-    static inline shared_buffer_t make_shared_buffer(const buffer_t &data)
+    enum class receive_mode
     {
-        return make_shared_buffer(data.data(), data.size());
+        copy,       // the received bytes are copied in a new buffer before calling on_receive, the receive buffer is reused
+        zero_copy   // the filled buffer is handed to on_receive and a fresh one is taken for the next receive
+    };
+
+#ifndef HL_NET_DEFAULT_RECEIVE_MODE
+    #define HL_NET_DEFAULT_RECEIVE_MODE hl::net::receive_mode::zero_copy
+#endif
+
+    // When on_sent is called for the messages written together by a tcp connection
+    enum class sent_notification
+    {
+        per_message,    // once per send() with its size
+        per_batch       // once per write with the bytes of every message it gathered
+    };
+
+#ifndef HL_NET_DEFAULT_SENT_NOTIFICATION
+    #define HL_NET_DEFAULT_SENT_NOTIFICATION hl::net::sent_notification::per_message
+#endif
+
+#ifndef HL_NET_TCP_MAX_WRITE_BYTES
+    // Bytes a tcp connection gathers in a single write (a bigger message is still written alone)
+    #define HL_NET_TCP_MAX_WRITE_BYTES (256 * 1024)
+#endif
+
+#ifndef HL_NET_TCP_MAX_WRITE_BUFFERS
+    // Buffers a tcp connection gathers in a single write, one writev handles at most 64 of them
+    #define HL_NET_TCP_MAX_WRITE_BUFFERS 64
+#endif
+
+#ifndef HL_NET_UDP_BATCH_SIZE
+    // Datagrams a udp server socket receives with one recvmmsg and sends with one sendmmsg
+    #define HL_NET_UDP_BATCH_SIZE 32
+#endif
+
+static_assert(HL_NET_UDP_BATCH_SIZE > 0, "HL_NET_UDP_BATCH_SIZE must be greater than 0");
+
+#ifndef HL_NET_UDP_MAX_SEGMENTS
+    // Datagrams a single segmented udp send may be split in (the kernel refuses more than 64 before linux 6.x)
+    #define HL_NET_UDP_MAX_SEGMENTS 64
+#endif
+
+#ifndef HL_NET_UDP_MAX_PAYLOAD
+    // Bytes a udp send may carry, segmented or not (65535 minus the ipv4 and udp headers)
+    #define HL_NET_UDP_MAX_PAYLOAD 65507
+#endif
+
+#ifndef HL_NET_UDP_GRO_BUFFER_SIZE
+    // Capacity of the receive buffers once UDP_GRO is enabled, a receive may hold many coalesced datagrams
+    #define HL_NET_UDP_GRO_BUFFER_SIZE 65536
+#endif
+
+#ifndef HL_NET_DEFAULT_SEND_HIGH_WATERMARK
+    // Bytes queued behind a connection from which its sends report being over the watermark
+    #define HL_NET_DEFAULT_SEND_HIGH_WATERMARK (4 * 1024 * 1024)
+#endif
+
+#ifndef HL_NET_DEFAULT_SEND_LOW_WATERMARK
+    // Bytes queued behind a connection under which on_writable is called once it went over the high watermark
+    #define HL_NET_DEFAULT_SEND_LOW_WATERMARK (1024 * 1024)
+#endif
+
+    // What a send reports, converts to true when the message was queued.
+    // over_watermark() tells that the bytes waiting to be written reached the high watermark: the message is still
+    // queued but the producer should wait for on_writable before sending more.
+    class send_result final
+    {
+    private:
+        bool m_queued;
+        bool m_over_watermark;
+
+    public:
+        send_result(const bool queued = false, const bool over_watermark = false)
+            : m_queued(queued)
+            , m_over_watermark(queued && over_watermark)
+        {}
+
+        bool queued() const { return m_queued; }
+        bool over_watermark() const { return m_over_watermark; }
+
+        operator bool() const { return m_queued; }
+    };
+
+    // Bytes queued by the sends of a connection and not written yet, with the watermarks on_writable is driven by
+    class send_backlog final
+    {
+    private:
+        std::atomic<size_t> m_bytes;
+        std::atomic<size_t> m_high_watermark;
+        std::atomic<size_t> m_low_watermark;
+        // set when a send reached the high watermark, cleared by the completion that brings the backlog to the low one
+        std::atomic_bool m_over_watermark;
+
+    public:
+        send_backlog()
+            : m_bytes(0)
+            , m_high_watermark(HL_NET_DEFAULT_SEND_HIGH_WATERMARK)
+            , m_low_watermark(HL_NET_DEFAULT_SEND_LOW_WATERMARK)
+            , m_over_watermark(false)
+        {}
+
+        send_backlog(const send_backlog &) = delete;
+        send_backlog &operator=(const send_backlog &) = delete;
+
+        // the low watermark is capped to the high one
+        void set_watermarks(const size_t high, const size_t low)
+        {
+            m_high_watermark = high;
+            m_low_watermark = std::min(low, high);
+        }
+
+        size_t high_watermark() const { return m_high_watermark; }
+        size_t low_watermark() const { return m_low_watermark; }
+        size_t bytes() const { return m_bytes; }
+
+        // must be called before the message is handed to the socket so that its completion comes after,
+        // true when the backlog reached the high watermark
+        bool add(const size_t bytes)
+        {
+            if (m_bytes.fetch_add(bytes) + bytes < m_high_watermark)
+            {
+                return false;
+            }
+            m_over_watermark = true;
+            return true;
+        }
+
+        // called once the message is written or failed, true when the caller must report the connection writable
+        bool remove(const size_t bytes)
+        {
+            return m_bytes.fetch_sub(bytes) - bytes <= m_low_watermark && m_over_watermark.exchange(false);
+        }
+    };
+
+#ifndef HL_NET_DEFAULT_RECEIVE_BACKLOG_HIGH
+    // Async callbacks of a connection waiting to run from which it stops receiving (0 never pauses)
+    #define HL_NET_DEFAULT_RECEIVE_BACKLOG_HIGH 0
+#endif
+
+#ifndef HL_NET_DEFAULT_RECEIVE_BACKLOG_LOW
+    // Async callbacks of a connection waiting to run under which it receives again after such a pause
+    #define HL_NET_DEFAULT_RECEIVE_BACKLOG_LOW 0
+#endif
+
+    // Pauses of the receive loop of a connection: asked with pause()/resume(), or taken while too many of its async
+    // callbacks wait to run. The loop stops re-arming while paused, the call that ends the pause restarts it.
+    class receive_flow final
+    {
+    private:
+        std::atomic_bool m_paused;
+        // set when the backlog reached the high mark, cleared by the callback that brings it to the low one
+        std::atomic_bool m_backlogged;
+        // held while a receive is armed or about to be, by the loop or by the one restarting it
+        std::atomic_bool m_reading;
+        std::atomic<size_t> m_async_backlog;
+        std::atomic<size_t> m_backlog_high;
+        std::atomic<size_t> m_backlog_low;
+
+        // true when the caller must restart the loop
+        bool _try_restart()
+        {
+            return !paused() && !m_reading.exchange(true);
+        }
+
+    public:
+        receive_flow()
+            : m_paused(false)
+            , m_backlogged(false)
+            , m_reading(true)
+            , m_async_backlog(0)
+            , m_backlog_high(HL_NET_DEFAULT_RECEIVE_BACKLOG_HIGH)
+            , m_backlog_low(HL_NET_DEFAULT_RECEIVE_BACKLOG_LOW)
+        {}
+
+        receive_flow(const receive_flow &) = delete;
+        receive_flow &operator=(const receive_flow &) = delete;
+
+        // a high mark of 0 disables the automatic pause, the low mark is capped under the high one
+        void set_backlog_marks(const size_t high, const size_t low)
+        {
+            m_backlog_high = high;
+            m_backlog_low = high ? std::min(low, high - 1) : 0;
+        }
+
+        size_t backlog_high() const { return m_backlog_high; }
+        size_t backlog_low() const { return m_backlog_low; }
+        size_t async_backlog() const { return m_async_backlog; }
+
+        bool paused() const
+        {
+            return m_paused || m_backlogged;
+        }
+
+        // the loop owns the reading from now on (a new connection of a client)
+        void restart()
+        {
+            m_reading = true;
+        }
+
+        // by the loop before arming the next receive, false when it must stop: the end of the pause restarts it
+        bool keep_reading()
+        {
+            if (!paused())
+            {
+                return true;
+            }
+            m_reading = false;
+            return _try_restart();
+        }
+
+        void pause()
+        {
+            m_paused = true;
+        }
+
+        // true when the caller must restart the loop
+        bool resume()
+        {
+            m_paused = false;
+            return _try_restart();
+        }
+
+        // before the async callback is posted
+        void async_posted()
+        {
+            const size_t backlog = m_async_backlog.fetch_add(1) + 1;
+            const size_t high = m_backlog_high;
+            if (high && backlog >= high)
+            {
+                m_backlogged = true;
+            }
+        }
+
+        // once the async callback ran, true when the caller must restart the loop
+        bool async_done()
+        {
+            return m_async_backlog.fetch_sub(1) - 1 <= m_backlog_low && m_backlogged.exchange(false) && _try_restart();
+        }
+    };
+
+    // Gives the buffer used by the next receive in zero_copy mode, it is filled up to its capacity (a null buffer falls back to make_uninitialized_shared_buffer)
+    using buffer_provider_t = std::function<shared_buffer_t(void)>;
+
+    // Owns the buffer an async receive is filled into and decides what is handed to the callbacks.
+    // Only one receive may be pending on a holder, the mode and the provider must be set before receiving.
+    class receive_buffer_holder final
+    {
+    private:
+        receive_mode m_mode;
+        buffer_provider_t m_provider;
+        shared_buffer_t m_buffer;
+
+        shared_buffer_t _make_buffer() const
+        {
+            if (m_provider)
+            {
+                shared_buffer_t buffer = m_provider();
+                if (buffer)
+                {
+                    return buffer;
+                }
+            }
+            return make_uninitialized_shared_buffer();
+        }
+
+    public:
+        receive_buffer_holder()
+            : m_mode(HL_NET_DEFAULT_RECEIVE_MODE)
+            , m_provider(nullptr)
+            , m_buffer(make_uninitialized_shared_buffer())
+        {}
+
+        ~receive_buffer_holder() = default;
+
+        receive_buffer_holder(const receive_buffer_holder &) = delete;
+        receive_buffer_holder &operator=(const receive_buffer_holder &) = delete;
+
+        receive_mode mode() const
+        {
+            return m_mode;
+        }
+
+        void set_mode(const receive_mode mode)
+        {
+            m_mode = mode;
+        }
+
+        void set_provider(const buffer_provider_t &provider)
+        {
+            m_provider = provider;
+            m_buffer = _make_buffer();
+        }
+
+        // buffer the next receive must be filled into (up to its capacity)
+        const shared_buffer_t &current() const
+        {
+            return m_buffer;
+        }
+
+        // buffer to give to the callbacks once `bytes` were received in current(), its size() is `bytes`
+        shared_buffer_t take(const size_t bytes)
+        {
+            if (m_mode == receive_mode::copy)
+            {
+                return make_shared_buffer(m_buffer->data(), bytes);
+            }
+            shared_buffer_t filled = _make_buffer();
+            filled.swap(m_buffer);
+            filled->resize(bytes);
+            return filled;
+        }
+    };
+
+    // Preallocates `count` shared buffers (payload and control block) in the buffer_pool global free list
+    static inline void warm_up_shared_buffers(const size_t count)
+    {
+        std::vector<shared_buffer_t> buffers;
+        buffers.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            buffers.push_back(make_uninitialized_shared_buffer());
+        }
+        buffers.clear();
+        buffer_pool::instance().flush_thread_cache();
+    }
+
+    static inline buffer_pool_stats get_buffer_pool_stats()
+    {
+        return buffer_pool::instance().stats();
     }
 
 }
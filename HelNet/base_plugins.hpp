@@ -5,6 +5,7 @@ Copyright: (C) 2024 Mattis DALLEAU
 
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <unordered_map>
 
@@ -18,6 +19,7 @@ namespace plugins
     struct base_plugin
     {
         using unique_t = std::unique_ptr<base_plugin>;
+        using shared_t = std::shared_ptr<base_plugin>;
 
         using updatable_t = Updatable;
         using callbacks_t = Callbacks;
@@ -27,6 +29,10 @@ namespace plugins
         virtual bool require_connection_on() const = 0;
         virtual void on_update(updatable_t &updatable) = 0;
 
+        // on_update is run on the async callbacks pool of the updatable instead of the thread calling update(),
+        // an update is skipped while the previous one is still running
+        virtual bool update_async() const { return false; }
+
         virtual callbacks_t callbacks() = 0;
     };
 
@@ -36,14 +42,46 @@ namespace plugins
     public:
         using base_plugin_t = PluginBase;
         using unique_plugin_t = typename base_plugin_t::unique_t;
+        using shared_plugin_t = typename base_plugin_t::shared_t;
         using updatable_t = typename base_plugin_t::updatable_t;
 
     private:
-        std::unordered_map<std::string, unique_plugin_t> m_plugins;
+        struct attached_plugin final
+        {
+            shared_plugin_t plugin = nullptr;
+            std::shared_ptr<std::atomic_bool> updating = nullptr; // an async update is pending or running
+        };
+
+        std::unordered_map<std::string, attached_plugin> m_plugins;
 
         template<class T>
         static const char *gen_name() noexcept { return typeid(T).name(); }
 
+        // the task keeps the plugin alive if it is detached in the meantime
+        static void _update_async(updatable_t &updatable, const attached_plugin &attached)
+        {
+            if (attached.updating->exchange(true))
+            {
+                return;
+            }
+
+            const shared_plugin_t plugin = attached.plugin;
+            const std::shared_ptr<std::atomic_bool> updating = attached.updating;
+            updatable_t target = updatable;
+            updatable->callbacks_register().post_async([plugin, updating, target]() mutable -> void {
+                try
+                {
+                    plugin->on_update(target);
+                }
+                catch (...)
+                {
+                    *updating = false;
+                    throw;
+                }
+                *updating = false;
+            });
+        }
+
     public:
         plugin_manager()
             : m_plugins()
@@ -56,9 +94,9 @@ namespace plugins
         void attach(updatable_t &updatable, Args... args)
         {
             HL_NET_LOG_INFO("Attaching plugin: {} to {}", gen_name<T>(), updatable->get_alias());
-            unique_plugin_t plugin = unique_plugin_t(new T(std::forward<Args>(args)...));
+            shared_plugin_t plugin = shared_plugin_t(new T(std::forward<Args>(args)...));
             updatable->callbacks_register().add_layer(gen_name<T>(), plugin->callbacks());
-            m_plugins[gen_name<T>()] = std::move(plugin);
+            m_plugins[gen_name<T>()] = attached_plugin{plugin, std::make_shared<std::atomic_bool>(false)};
         }
 
         template<class T>
@@ -69,17 +107,26 @@ namespace plugins
             m_plugins.erase(gen_name<T>());
         }
 
+        bool empty() const
+        {
+            return m_plugins.empty();
+        }
+
         void update(updatable_t &updatable)
         {
             for (auto &plugin : m_plugins)
             {
-                if (plugin.second->require_connection_on() && !updatable->healthy())
+                if (plugin.second.plugin->require_connection_on() && !updatable->healthy())
                 {
                     continue;
                 }
+                else if (plugin.second.plugin->update_async())
+                {
+                    _update_async(updatable, plugin.second);
+                }
                 else
                 {
-                    plugin.second->on_update(updatable);
+                    plugin.second.plugin->on_update(updatable);
                 }
             }
         }
@@ -0,0 +1,374 @@
+/*
+This code is licensed under the GNU GPL v3.
+Copyright: (C) 2024 Mattis DALLEAU
+*/
+
+#pragma once
+
+#include <hl/silva/collections/meta.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace hl
+{
+namespace net
+{
+
+// Smallest pooled block is 1 << HL_NET_BUFFER_POOL_MIN_CLASS_SHIFT bytes
+#ifndef HL_NET_BUFFER_POOL_MIN_CLASS_SHIFT
+    #define HL_NET_BUFFER_POOL_MIN_CLASS_SHIFT 6
+#endif
+
+// Blocks bigger than 1 << HL_NET_BUFFER_POOL_MAX_CLASS_SHIFT bytes are not pooled
+#ifndef HL_NET_BUFFER_POOL_MAX_CLASS_SHIFT
+    #define HL_NET_BUFFER_POOL_MAX_CLASS_SHIFT 20
+#endif
+
+// Maximum number of blocks kept per size class in each thread cache
+#ifndef HL_NET_BUFFER_POOL_THREAD_CACHE_SIZE
+    #define HL_NET_BUFFER_POOL_THREAD_CACHE_SIZE 64
+#endif
+
+// Number of shared buffers preallocated by the servers on start()
+#ifndef HL_NET_BUFFER_POOL_WARM_UP
+    #define HL_NET_BUFFER_POOL_WARM_UP 256
+#endif
+
+static_assert(HL_NET_BUFFER_POOL_MIN_CLASS_SHIFT >= 4, "HL_NET_BUFFER_POOL_MIN_CLASS_SHIFT must be at least 4 (16 bytes)");
+static_assert(HL_NET_BUFFER_POOL_MAX_CLASS_SHIFT >= HL_NET_BUFFER_POOL_MIN_CLASS_SHIFT, "HL_NET_BUFFER_POOL_MAX_CLASS_SHIFT must be greater or equal to HL_NET_BUFFER_POOL_MIN_CLASS_SHIFT");
+static_assert(HL_NET_BUFFER_POOL_THREAD_CACHE_SIZE >= 2, "HL_NET_BUFFER_POOL_THREAD_CACHE_SIZE must be at least 2");
+
+    struct buffer_pool_stats final {
+        std::uint64_t allocations = 0;          // every allocate() call
+        std::uint64_t deallocations = 0;        // every deallocate() call
+        std::uint64_t thread_cache_hits = 0;    // served by the calling thread cache
+        std::uint64_t global_hits = 0;          // served by a refill from the global free list
+        std::uint64_t system_allocations = 0;   // pooled size classes that had to hit operator new
+        std::uint64_t oversized_allocations = 0;// bigger than the last size class (never pooled)
+        std::uint64_t global_cached_blocks = 0; // blocks currently waiting in the global free list
+    };
+
+    // Size classed block pool used to recycle the buffers and their shared_ptr control blocks.
+    // Each thread keeps a small cache per size class, refilled from and flushed to a global free list in batches.
+    class buffer_pool final : public hl::silva::collections::meta::NonCopyMoveable
+    {
+    public:
+        static constexpr std::size_t MIN_CLASS_SHIFT = HL_NET_BUFFER_POOL_MIN_CLASS_SHIFT;
+        static constexpr std::size_t MAX_CLASS_SHIFT = HL_NET_BUFFER_POOL_MAX_CLASS_SHIFT;
+        static constexpr std::size_t CLASS_COUNT = MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1;
+        static constexpr std::size_t THREAD_CACHE_SIZE = HL_NET_BUFFER_POOL_THREAD_CACHE_SIZE;
+        static constexpr std::size_t INVALID_CLASS = CLASS_COUNT;
+
+    private:
+        struct free_list final {
+            std::mutex mutex;
+            std::vector<void *> blocks;
+
+            free_list() : mutex(), blocks() {}
+        };
+
+        // only written by the owning thread, read by stats()
+        struct counters final {
+            std::atomic<std::uint64_t> allocations;
+            std::atomic<std::uint64_t> deallocations;
+            std::atomic<std::uint64_t> thread_cache_hits;
+            std::atomic<std::uint64_t> global_hits;
+            std::atomic<std::uint64_t> system_allocations;
+            std::atomic<std::uint64_t> oversized_allocations;
+
+            counters()
+                : allocations(0)
+                , deallocations(0)
+                , thread_cache_hits(0)
+                , global_hits(0)
+                , system_allocations(0)
+                , oversized_allocations(0)
+            {}
+
+            static void bump(std::atomic<std::uint64_t> &counter)
+            {
+                counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+
+            void add_to(buffer_pool_stats &stats) const
+            {
+                stats.allocations += allocations.load(std::memory_order_relaxed);
+                stats.deallocations += deallocations.load(std::memory_order_relaxed);
+                stats.thread_cache_hits += thread_cache_hits.load(std::memory_order_relaxed);
+                stats.global_hits += global_hits.load(std::memory_order_relaxed);
+                stats.system_allocations += system_allocations.load(std::memory_order_relaxed);
+                stats.oversized_allocations += oversized_allocations.load(std::memory_order_relaxed);
+            }
+        };
+
+        struct thread_cache final {
+            std::array<std::vector<void *>, CLASS_COUNT> blocks;
+            counters stats;
+
+            thread_cache()
+                : blocks()
+                , stats()
+            {
+                buffer_pool::instance()._register_cache(this);
+            }
+
+            thread_cache(const thread_cache &) = delete;
+            thread_cache &operator=(const thread_cache &) = delete;
+
+            ~thread_cache()
+            {
+                buffer_pool &pool = buffer_pool::instance();
+                for (std::size_t block_class = 0; block_class < CLASS_COUNT; ++block_class)
+                {
+                    pool._release_to_global(block_class, blocks[block_class], blocks[block_class].size());
+                }
+                pool._unregister_cache(this);
+            }
+        };
+
+        std::array<free_list, CLASS_COUNT> m_global;
+
+        std::vector<thread_cache *> m_caches;
+        buffer_pool_stats m_retired_stats; // counters of the threads that exited
+        std::mutex m_caches_mutex;
+
+        buffer_pool()
+            : m_global()
+            , m_caches()
+            , m_retired_stats()
+            , m_caches_mutex()
+        {}
+
+        static thread_cache &_thread_cache()
+        {
+            static thread_local thread_cache cache;
+            return cache;
+        }
+
+        void _register_cache(thread_cache *cache)
+        {
+            std::lock_guard<std::mutex> lock(m_caches_mutex);
+            m_caches.push_back(cache);
+        }
+
+        void _unregister_cache(thread_cache *cache)
+        {
+            std::lock_guard<std::mutex> lock(m_caches_mutex);
+            cache->stats.add_to(m_retired_stats);
+            m_caches.erase(std::remove(m_caches.begin(), m_caches.end(), cache), m_caches.end());
+        }
+
+        // moves the `count` last blocks of `blocks` to the global free list
+        void _release_to_global(const std::size_t block_class, std::vector<void *> &blocks, const std::size_t count)
+        {
+            if (count == 0)
+            {
+                return;
+            }
+            free_list &global = m_global[block_class];
+            std::lock_guard<std::mutex> lock(global.mutex);
+            global.blocks.insert(global.blocks.end(), blocks.end() - static_cast<std::ptrdiff_t>(count), blocks.end());
+            blocks.resize(blocks.size() - count);
+        }
+
+        // moves up to `count` blocks from the global free list to `blocks`
+        bool _acquire_from_global(const std::size_t block_class, std::vector<void *> &blocks, const std::size_t count)
+        {
+            free_list &global = m_global[block_class];
+            std::lock_guard<std::mutex> lock(global.mutex);
+            const std::size_t taken = std::min(count, global.blocks.size());
+            blocks.insert(blocks.end(), global.blocks.end() - static_cast<std::ptrdiff_t>(taken), global.blocks.end());
+            global.blocks.resize(global.blocks.size() - taken);
+            return taken != 0;
+        }
+
+    public:
+        // The pool is never destroyed so thread caches can flush back to it during static destruction
+        static buffer_pool &instance()
+        {
+            static buffer_pool *pool = new buffer_pool();
+            return *pool;
+        }
+
+        // index of the smallest class able to hold `bytes` (INVALID_CLASS when it is too big to be pooled)
+        static std::size_t size_class(const std::size_t bytes)
+        {
+            if (bytes <= class_size(0))
+            {
+                return 0;
+            }
+#if __GNUC__ || __clang__
+            const std::size_t shift = static_cast<std::size_t>(static_cast<int>(sizeof(unsigned long) * 8) - __builtin_clzl(bytes - 1));
+            return shift > MAX_CLASS_SHIFT ? INVALID_CLASS : shift - MIN_CLASS_SHIFT;
+#else
+            std::size_t block_class = 0;
+            while (block_class < CLASS_COUNT && class_size(block_class) < bytes)
+            {
+                ++block_class;
+            }
+            return block_class;
+#endif
+        }
+
+        static constexpr std::size_t class_size(const std::size_t block_class)
+        {
+            return std::size_t(1) << (block_class + MIN_CLASS_SHIFT);
+        }
+
+        void *allocate(const std::size_t bytes)
+        {
+            thread_cache &cache = _thread_cache();
+            counters::bump(cache.stats.allocations);
+
+            const std::size_t block_class = size_class(bytes);
+            if (block_class == INVALID_CLASS)
+            {
+                counters::bump(cache.stats.oversized_allocations);
+                return ::operator new(bytes);
+            }
+
+            std::vector<void *> &blocks = cache.blocks[block_class];
+            if (!blocks.empty())
+            {
+                counters::bump(cache.stats.thread_cache_hits);
+            }
+            else if (_acquire_from_global(block_class, blocks, THREAD_CACHE_SIZE / 2))
+            {
+                counters::bump(cache.stats.global_hits);
+            }
+            else
+            {
+                counters::bump(cache.stats.system_allocations);
+                return ::operator new(class_size(block_class));
+            }
+
+            void *block = blocks.back();
+            blocks.pop_back();
+            return block;
+        }
+
+        void deallocate(void *block, const std::size_t bytes)
+        {
+            if (block == nullptr)
+            {
+                return;
+            }
+            thread_cache &cache = _thread_cache();
+            counters::bump(cache.stats.deallocations);
+
+            const std::size_t block_class = size_class(bytes);
+            if (block_class == INVALID_CLASS)
+            {
+                ::operator delete(block);
+                return;
+            }
+
+            std::vector<void *> &blocks = cache.blocks[block_class];
+            if (blocks.size() >= THREAD_CACHE_SIZE)
+            {
+                _release_to_global(block_class, blocks, THREAD_CACHE_SIZE / 2);
+            }
+            blocks.push_back(block);
+        }
+
+        // Gives every block cached by the calling thread back to the global free list
+        void flush_thread_cache()
+        {
+            thread_cache &cache = _thread_cache();
+            for (std::size_t block_class = 0; block_class < CLASS_COUNT; ++block_class)
+            {
+                _release_to_global(block_class, cache.blocks[block_class], cache.blocks[block_class].size());
+            }
+        }
+
+        // Makes sure that at least `count` blocks able to hold `bytes` are waiting in the global free list
+        void warm_up(const std::size_t bytes, const std::size_t count)
+        {
+            const std::size_t block_class = size_class(bytes);
+            if (block_class == INVALID_CLASS)
+            {
+                return;
+            }
+            thread_cache &cache = _thread_cache();
+            free_list &global = m_global[block_class];
+            std::lock_guard<std::mutex> lock(global.mutex);
+            global.blocks.reserve(count);
+            while (global.blocks.size() < count)
+            {
+                global.blocks.push_back(::operator new(class_size(block_class)));
+                counters::bump(cache.stats.system_allocations);
+            }
+        }
+
+        // Releases every block of the global free list to the system (thread caches are left untouched)
+        void trim()
+        {
+            for (free_list &global : m_global)
+            {
+                std::lock_guard<std::mutex> lock(global.mutex);
+                for (void *block : global.blocks)
+                {
+                    ::operator delete(block);
+                }
+                global.blocks.clear();
+                global.blocks.shrink_to_fit();
+            }
+        }
+
+        buffer_pool_stats stats()
+        {
+            buffer_pool_stats stats;
+            {
+                std::lock_guard<std::mutex> lock(m_caches_mutex);
+                stats = m_retired_stats;
+                for (const thread_cache *cache : m_caches)
+                {
+                    cache->stats.add_to(stats);
+                }
+            }
+            for (free_list &global : m_global)
+            {
+                std::lock_guard<std::mutex> lock(global.mutex);
+                stats.global_cached_blocks += global.blocks.size();
+            }
+            return stats;
+        }
+    };
+
+    // Standard allocator backed by the buffer_pool (used with boost::allocate_shared so the object and its control block are recycled)
+    template<typename T>
+    struct buffer_pool_allocator
+    {
+        using value_type = T;
+
+        buffer_pool_allocator() noexcept = default;
+
+        template<typename U>
+        buffer_pool_allocator(const buffer_pool_allocator<U> &) noexcept {}
+
+        T *allocate(const std::size_t n)
+        {
+            return static_cast<T *>(buffer_pool::instance().allocate(n * sizeof(T)));
+        }
+
+        void deallocate(T *ptr, const std::size_t n) noexcept
+        {
+            buffer_pool::instance().deallocate(ptr, n * sizeof(T));
+        }
+
+        template<typename U>
+        bool operator==(const buffer_pool_allocator<U> &) const noexcept { return true; }
+
+        template<typename U>
+        bool operator!=(const buffer_pool_allocator<U> &) const noexcept { return false; }
+    };
+
+}
+}
@@ -0,0 +1,32 @@
+/*
+This code is licensed under the GNU GPL v3.
+Copyright: (C) 2024 Mattis DALLEAU
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "HelNet/snapshot.hpp"
+
+namespace hl
+{
+namespace net
+{
+    // handler of one event on one layer
+    template<typename Callback>
+    struct callback_handler final
+    {
+        Callback callback;
+        bool is_async;
+    };
+
+    template<typename Callback>
+    using callback_handlers_t = std::vector<callback_handler<Callback>>;
+
+    // The non-null handlers of one event in layer order, read by the dispatch without lock.
+    // The register rebuilds them under its mutex each time a layer or a callback changes and swaps them in.
+    template<typename Callback>
+    using callback_handlers_snapshot = shared_snapshot<callback_handlers_t<Callback>>;
+}
+}
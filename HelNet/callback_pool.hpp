@@ -0,0 +1,450 @@
+/*
+This code is licensed under the GNU GPL v3.
+Copyright: (C) 2024 Mattis DALLEAU
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <hl/silva/collections/meta.hpp>
+
+#include "HelNet/logger.hpp"
+#include "HelNet/snapshot.hpp"
+
+// Threads running the callbacks flagged as async of a callback register, started on the first async callback
+#ifndef HL_NET_CALLBACK_POOL_THREADS
+    #define HL_NET_CALLBACK_POOL_THREADS 2
+#endif
+
+namespace hl
+{
+namespace net
+{
+    struct callback_pool_stats final {
+        std::uint64_t workers = 0;              // threads currently started
+        std::uint64_t executed = 0;             // tasks run by the workers
+        std::uint64_t inline_runs = 0;          // tasks run by the poster because the pool was stopped
+        std::uint64_t steals = 0;               // successful steals from another worker
+        std::uint64_t stolen_tasks = 0;         // tasks moved by those steals
+        std::uint64_t parks = 0;                // times a worker went to sleep with nothing to run or steal
+        std::uint64_t queue_depth = 0;          // tasks currently waiting in the queues
+    };
+
+    // Work stealing executor running the async callbacks of a callback register off the io threads.
+    // Every worker owns two queues:
+    // - the pinned one receives the tasks posted with a key, they run on the worker the key maps to in the order
+    //   they were posted (the callbacks of a connection are keyed by its id) and are never stolen;
+    // - the stealable one receives the tasks posted without key, spread round-robin. An idle worker steals half of
+    //   the stealable queue of a busy one before going to sleep (parking), a post wakes a parked worker up.
+    // Posting while the pool is stopped runs the task inline so that no callback is lost.
+    class callback_pool final : public hl::silva::collections::meta::NonCopyMoveable
+    {
+    public:
+        using task_t = std::function<void(void)>;
+        using key_t = std::uint64_t;
+
+        // the key of the tasks with no order to keep, post(NO_KEY, task) is post(task)
+        static constexpr key_t NO_KEY = std::numeric_limits<key_t>::max();
+
+    private:
+        struct worker final : public hl::silva::collections::meta::NonCopyMoveable
+        {
+            std::deque<task_t> pinned;
+            std::deque<task_t> stealable;
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::thread thread;
+            bool running;
+            bool parked;
+            bool woken; // a stealable task was posted elsewhere while parked
+
+            worker()
+                : pinned()
+                , stealable()
+                , mutex()
+                , cv()
+                , thread()
+                , running(true)
+                , parked(false)
+                , woken(false)
+            {}
+
+            bool has_task() const
+            {
+                return !pinned.empty() || !stealable.empty();
+            }
+        };
+
+        using workers_t = std::vector<std::shared_ptr<worker>>;
+        using workers_snapshot_t = shared_snapshot<std::shared_ptr<const workers_t>>;
+
+        // read by post() without lock nor reference count, replaced under m_control_mutex (null while stopped)
+        mutable workers_snapshot_t m_workers;
+        std::mutex m_control_mutex;
+        std::atomic<size_t> m_next_worker;
+        size_t m_threads_count;
+        std::atomic_bool m_running;
+
+        // shared with the workers, a worker detached by a stop() from its own callback may outlive the pool
+        struct counters final : public hl::silva::collections::meta::NonCopyMoveable
+        {
+            std::atomic<size_t> parked_workers;
+            std::atomic<std::uint64_t> executed;
+            std::atomic<std::uint64_t> inline_runs;
+            std::atomic<std::uint64_t> steals;
+            std::atomic<std::uint64_t> stolen_tasks;
+            std::atomic<std::uint64_t> parks;
+            std::atomic<std::uint64_t> queue_depth;
+
+            counters()
+                : parked_workers(0)
+                , executed(0)
+                , inline_runs(0)
+                , steals(0)
+                , stolen_tasks(0)
+                , parks(0)
+                , queue_depth(0)
+            {}
+        };
+
+        const std::shared_ptr<counters> m_counters;
+
+        // pinned tasks first: they are the only ones nobody else can run
+        static bool _pop(worker &self, task_t &task)
+        {
+            if (!self.pinned.empty())
+            {
+                task = std::move(self.pinned.front());
+                self.pinned.pop_front();
+                return true;
+            }
+            if (!self.stealable.empty())
+            {
+                task = std::move(self.stealable.front());
+                self.stealable.pop_front();
+                return true;
+            }
+            return false;
+        }
+
+        // moves the back half of the stealable queue of another worker into the one of self
+        static bool _steal(counters &stats, const workers_t &workers, const size_t self_index)
+        {
+            worker &self = *workers[self_index];
+
+            for (size_t offset = 1; offset < workers.size(); ++offset)
+            {
+                worker &victim = *workers[(self_index + offset) % workers.size()];
+                std::deque<task_t> stolen;
+                {
+                    std::lock_guard<std::mutex> lock(victim.mutex);
+                    const size_t count = (victim.stealable.size() + 1) / 2;
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        stolen.push_front(std::move(victim.stealable.back()));
+                        victim.stealable.pop_back();
+                    }
+                }
+                if (stolen.empty())
+                {
+                    continue;
+                }
+
+                stats.steals.fetch_add(1, std::memory_order_relaxed);
+                stats.stolen_tasks.fetch_add(stolen.size(), std::memory_order_relaxed);
+                std::lock_guard<std::mutex> lock(self.mutex);
+                for (task_t &task : stolen)
+                {
+                    self.stealable.push_back(std::move(task));
+                }
+                return true;
+            }
+            return false;
+        }
+
+        static void _worker_loop(const std::shared_ptr<counters> stats, const std::shared_ptr<const workers_t> workers, const size_t self_index)
+        {
+            worker &self = *(*workers)[self_index];
+
+            while (true)
+            {
+                task_t task;
+                bool popped = false;
+                {
+                    std::lock_guard<std::mutex> lock(self.mutex);
+                    popped = _pop(self, task);
+                    if (!popped && !self.running)
+                    {
+                        return; // stopped and drained
+                    }
+                }
+                if (popped)
+                {
+                    stats->queue_depth.fetch_sub(1, std::memory_order_relaxed);
+                    _run(task);
+                    stats->executed.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                if (_steal(*stats, *workers, self_index))
+                {
+                    continue;
+                }
+
+                // announced before the last steal attempt, a post either sees the worker parked or is seen by the steal
+                stats->parked_workers.fetch_add(1);
+                {
+                    std::lock_guard<std::mutex> lock(self.mutex);
+                    self.parked = true;
+                }
+                const bool stolen = _steal(*stats, *workers, self_index);
+                {
+                    std::unique_lock<std::mutex> lock(self.mutex);
+                    if (!stolen && !self.has_task() && !self.woken && self.running)
+                    {
+                        stats->parks.fetch_add(1, std::memory_order_relaxed);
+                        self.cv.wait(lock, [&self]() -> bool { return self.has_task() || self.woken || !self.running; });
+                    }
+                    self.parked = false;
+                    self.woken = false;
+                }
+                stats->parked_workers.fetch_sub(1);
+            }
+        }
+
+        static void _run(const task_t &task)
+        {
+            try
+            {
+                task();
+            }
+            catch (const std::exception &e)
+            {
+                HL_NET_LOG_ERROR("Exception in an async callback: {}", e.what());
+            }
+        }
+
+        void _unsafe_replace_workers(const std::shared_ptr<const workers_t> &workers)
+        {
+            m_workers.unsafe_replace(std::unique_ptr<const std::shared_ptr<const workers_t>>(new std::shared_ptr<const workers_t>(workers)));
+        }
+
+        // the workers, spawned by the first post after start(); only valid while a reader of m_workers is alive
+        const workers_t* _workers(const workers_snapshot_t::reader &pinned)
+        {
+            if (*pinned)
+            {
+                return pinned->get();
+            }
+
+            std::lock_guard<std::mutex> lock(m_control_mutex);
+            if (m_workers.unsafe_get() || !m_running)
+            {
+                return m_workers.unsafe_get().get();
+            }
+
+            std::shared_ptr<workers_t> spawned = std::make_shared<workers_t>();
+            spawned->reserve(m_threads_count);
+            for (size_t i = 0; i < m_threads_count; ++i)
+            {
+                spawned->push_back(std::make_shared<worker>());
+            }
+            const std::shared_ptr<const workers_t> workers = spawned;
+            for (size_t i = 0; i < workers->size(); ++i)
+            {
+                (*workers)[i]->thread = std::thread(&callback_pool::_worker_loop, m_counters, workers, i);
+            }
+            _unsafe_replace_workers(workers);
+            return workers.get();
+        }
+
+        // false when the worker was stopped in the meantime
+        bool _push(worker &target, const bool keyed, task_t &task)
+        {
+            std::lock_guard<std::mutex> lock(target.mutex);
+            if (!target.running)
+            {
+                return false;
+            }
+            (keyed ? target.pinned : target.stealable).push_back(std::move(task));
+            m_counters->queue_depth.fetch_add(1, std::memory_order_relaxed);
+            target.cv.notify_one();
+            return true;
+        }
+
+        // a stealable task can be run by any parked worker, the first one found is woken up
+        void _wake_parked(const workers_t &workers, const worker &target)
+        {
+            if (m_counters->parked_workers.load() == 0)
+            {
+                return;
+            }
+            for (const std::shared_ptr<worker> &candidate : workers)
+            {
+                if (candidate.get() == &target)
+                {
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(candidate->mutex);
+                if (candidate->parked && !candidate->woken)
+                {
+                    candidate->woken = true;
+                    candidate->cv.notify_one();
+                    return;
+                }
+            }
+        }
+
+        void _post(const key_t key, const bool keyed, task_t &task)
+        {
+            if (m_running)
+            {
+                const workers_snapshot_t::reader pinned(m_workers);
+                const workers_t *workers = _workers(pinned);
+                if (workers && !workers->empty())
+                {
+                    const size_t index = keyed
+                        ? key % workers->size()
+                        : m_next_worker.fetch_add(1, std::memory_order_relaxed) % workers->size();
+                    worker &target = *(*workers)[index];
+                    if (_push(target, keyed, task))
+                    {
+                        if (!keyed)
+                        {
+                            _wake_parked(*workers, target);
+                        }
+                        return;
+                    }
+                }
+            }
+            m_counters->inline_runs.fetch_add(1, std::memory_order_relaxed);
+            _run(task);
+        }
+
+    public:
+        explicit callback_pool(const size_t threads = HL_NET_CALLBACK_POOL_THREADS)
+            : m_workers()
+            , m_control_mutex()
+            , m_next_worker(0)
+            , m_threads_count(threads ? threads : 1)
+            , m_running(false)
+            , m_counters(std::make_shared<counters>())
+        {}
+
+        ~callback_pool()
+        {
+            stop();
+        }
+
+        // applied on the next start()
+        void set_threads(const size_t threads)
+        {
+            std::lock_guard<std::mutex> lock(m_control_mutex);
+            m_threads_count = threads ? threads : 1;
+        }
+
+        void start()
+        {
+            std::lock_guard<std::mutex> lock(m_control_mutex);
+            m_running = true;
+        }
+
+        // runs the tasks already posted before returning
+        void stop()
+        {
+            std::shared_ptr<const workers_t> workers;
+            {
+                std::lock_guard<std::mutex> lock(m_control_mutex);
+                m_running = false;
+                workers = m_workers.unsafe_get();
+                _unsafe_replace_workers(nullptr);
+            }
+            if (!workers)
+            {
+                return;
+            }
+            for (const std::shared_ptr<worker> &stopped : *workers)
+            {
+                std::lock_guard<std::mutex> lock(stopped->mutex);
+                stopped->running = false;
+                stopped->cv.notify_one();
+            }
+            for (const std::shared_ptr<worker> &stopped : *workers)
+            {
+                if (stopped->thread.get_id() == std::this_thread::get_id())
+                {
+                    // stopped from one of its own callbacks, the thread exits once its queues are drained
+                    stopped->thread.detach();
+                }
+                else
+                {
+                    stopped->thread.join();
+                }
+            }
+        }
+
+        bool running() const
+        {
+            return m_running;
+        }
+
+        // tasks with the same key run in order on the same worker
+        void post(const key_t key, task_t task)
+        {
+            _post(key, key != NO_KEY, task);
+        }
+
+        // the task may run on any worker
+        void post(task_t task)
+        {
+            _post(0, false, task);
+        }
+
+        callback_pool_stats stats() const
+        {
+            callback_pool_stats stats;
+            {
+                const workers_snapshot_t::reader workers(m_workers);
+                stats.workers = *workers ? (*workers)->size() : 0;
+            }
+            stats.executed = m_counters->executed.load(std::memory_order_relaxed);
+            stats.inline_runs = m_counters->inline_runs.load(std::memory_order_relaxed);
+            stats.steals = m_counters->steals.load(std::memory_order_relaxed);
+            stats.stolen_tasks = m_counters->stolen_tasks.load(std::memory_order_relaxed);
+            stats.parks = m_counters->parks.load(std::memory_order_relaxed);
+            stats.queue_depth = m_counters->queue_depth.load(std::memory_order_relaxed);
+            return stats;
+        }
+    };
+
+    // Task counted by its owner while it waits and runs: owner->async_callback_posted() now,
+    // owner->async_callback_done() once it ran (even when it threw)
+    template<typename OwnerPointer>
+    static inline callback_pool::task_t make_counted_task(callback_pool::task_t task, const OwnerPointer &owner)
+    {
+        if (!owner)
+        {
+            return task;
+        }
+        owner->async_callback_posted();
+        return [task, owner]() -> void {
+            struct done_guard final
+            {
+                const OwnerPointer &owner;
+                ~done_guard() { owner->async_callback_done(); }
+            } guard = { owner };
+            task();
+        };
+    }
+}
+}
@@ -8,8 +8,9 @@ Copyright: (C) 2024 Mattis DALLEAU
 #include "HelNet/base.hpp"
 #include "HelNet/logger.hpp"
 #include "HelNet/defines.hpp"
+#include "HelNet/callback_pool.hpp"
+#include "HelNet/callback_handlers.hpp"
 
-#include <hl/silva/collections/threads/basic_pool_async.hpp>
 #include <boost/system/error_code.hpp>
 
 namespace hl
@@ -27,6 +28,7 @@ namespace net
     using client_on_receive_error_callback      = std::function<void(client_t client, shared_buffer_t buffer_copy, const boost::system::error_code ec, const size_t recv_bytes)>;
     using client_on_sent_callback               = std::function<void(client_t client, const size_t sent_bytes)>;
     using client_on_send_error_callback         = std::function<void(client_t client, const boost::system::error_code ec, const size_t sent_bytes)>;
+    using client_on_writable_callback           = std::function<void(client_t client)>;
 
     #define HL_NET_CLIENT_ON_CONNECT(CLIENT) [](client_t CLIENT)
     #define HL_NET_CLIENT_ON_CONNECT_CAPTURE(CLIENT, ...) [__VA_ARGS__](client_t CLIENT)
@@ -42,6 +44,8 @@ namespace net
     #define HL_NET_CLIENT_ON_SENT_CAPTURE(CLIENT, SENT_BYTES, ...) [__VA_ARGS__](client_t CLIENT, const size_t SENT_BYTES)
     #define HL_NET_CLIENT_ON_SEND_ERROR(CLIENT, EC, SENT_BYTES) [](client_t CLIENT, const boost::system::error_code EC, const size_t SENT_BYTES)
     #define HL_NET_CLIENT_ON_SEND_ERROR_CAPTURE(CLIENT, EC, SENT_BYTES, ...) [__VA_ARGS__](client_t CLIENT, const boost::system::error_code EC, const size_t SENT_BYTES)
+    #define HL_NET_CLIENT_ON_WRITABLE(CLIENT) [](client_t CLIENT)
+    #define HL_NET_CLIENT_ON_WRITABLE_CAPTURE(CLIENT, ...) [__VA_ARGS__](client_t CLIENT)
 
     struct client_callbacks final {
         client_on_connect_callback          on_connect_callback = nullptr;
@@ -64,18 +68,35 @@ namespace net
 
         client_on_send_error_callback       on_send_error_callback = nullptr;
         bool                                on_send_error_is_async = false;
+
+        client_on_writable_callback         on_writable_callback = nullptr;
+        bool                                on_writable_is_async = false;
     };
 
     class client_callback_register final : public hl::silva::collections::meta::NonCopyMoveable
     {
     private:
-        hl::silva::collections::threads::basic_pool_async m_pool;
+        callback_pool m_pool;
 
     private:
         callback_layer_register_t<client_callbacks> m_callbacks;
         mutable std::mutex m_callbacks_mutex;
         std::function<client_t(void)> m_get_sharable;
 
+        // a client is a single connection, all its async callbacks are run in order
+        template<typename ...Args>
+        static callback_pool::key_t _async_key(const Args&...)
+        {
+            return 0;
+        }
+
+        // the async callbacks are counted by the client until they ran (it may stop receiving meanwhile)
+        template<typename ...Args>
+        callback_pool::task_t _async_task(callback_pool::task_t task, const Args&...) const
+        {
+            return make_counted_task(std::move(task), m_get_sharable());
+        }
+
     public:
         _HL_INTERNAL_CALLBACK_IMPL_BASE(client_callbacks, m_pool, m_callbacks_mutex, m_callbacks);
 
@@ -86,20 +107,32 @@ namespace net
 #define _HL_INTERNAL_CLIENT_CALLBACK_REGISTER_IMPL_NO_SHARABLE(NAME) \
         _HL_INTERNAL_CALLBACK_REGISTER_IMPL_NO_SHARABLE(NAME, client, m_callbacks, m_pool, m_callbacks_mutex)
 
-        _HL_INTERNAL_CLIENT_CALLBACK_REGISTER_IMPL(on_connect);
-        _HL_INTERNAL_CLIENT_CALLBACK_REGISTER_IMPL_NO_SHARABLE(on_disconnect);
-        _HL_INTERNAL_CLIENT_CALLBACK_REGISTER_IMPL_NO_SHARABLE(on_disconnect_error);
-        _HL_INTERNAL_CLIENT_CALLBACK_REGISTER_IMPL(on_receive);
-        _HL_INTERNAL_CLIENT_CALLBACK_REGISTER_IMPL(on_receive_error);
-        _HL_INTERNAL_CLIENT_CALLBACK_REGISTER_IMPL(on_sent);
-        _HL_INTERNAL_CLIENT_CALLBACK_REGISTER_IMPL(on_send_error);
+// Every event of the register, with or without the client given to the callback
+#define _HL_INTERNAL_CLIENT_CALLBACKS(SHARABLE, NO_SHARABLE) \
+        SHARABLE(on_connect) \
+        NO_SHARABLE(on_disconnect) \
+        NO_SHARABLE(on_disconnect_error) \
+        SHARABLE(on_receive) \
+        SHARABLE(on_receive_error) \
+        SHARABLE(on_sent) \
+        SHARABLE(on_send_error) \
+        SHARABLE(on_writable)
+
+        _HL_INTERNAL_CLIENT_CALLBACKS(_HL_INTERNAL_CLIENT_CALLBACK_REGISTER_IMPL, _HL_INTERNAL_CLIENT_CALLBACK_REGISTER_IMPL_NO_SHARABLE)
+
+    private:
+        void _unsafe_rebuild_handlers(void)
+        {
+            _HL_INTERNAL_CLIENT_CALLBACKS(_HL_INTERNAL_CALLBACK_REGISTER_REBUILD_HANDLERS, _HL_INTERNAL_CALLBACK_REGISTER_REBUILD_HANDLERS)
+        }
 
+#undef _HL_INTERNAL_CLIENT_CALLBACKS
 #undef _HL_INTERNAL_CLIENT_CALLBACK_REGISTER_IMPL
 #undef _HL_INTERNAL_CLIENT_CALLBACK_REGISTER_IMPL_NO_SHARABLE
 
     public:
         client_callback_register(std::function<client_t(void)> get_sharable)
-            : m_pool(true)
+            : m_pool()
             , m_callbacks()
             , m_callbacks_mutex()
             , m_get_sharable(get_sharable)
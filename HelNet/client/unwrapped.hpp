@@ -7,10 +7,21 @@ Copyright: (C) 2024 Mattis DALLEAU
 
 #include "HelNet/client/callbacks.hpp"
 #include "HelNet/utils.hpp"
+#include "HelNet/event_notifier.hpp"
+#include "HelNet/mpsc_queue.hpp"
+#include "HelNet/udp_segmentation.hpp"
+#include <boost/asio/dispatch.hpp>
 #include <boost/asio/io_service.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/write.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/shared_ptr.hpp>
 
+#include <array>
+#include <cerrno>
+#include <memory>
+
 namespace hl
 {
 namespace net
@@ -27,33 +38,80 @@ HL_NET_DIAGNOSTIC_POP()
     public:
         virtual bool connect(const std::string &host, const std::string &port) = 0;
         virtual bool disconnect(void) = 0;
-        virtual bool send(const shared_buffer_t &buffer, const size_t &size) = 0;
+        virtual send_result send(const shared_buffer_t &buffer, const size_t &size) = 0;
+        // sends every piece as one message with a single scatter-gather system call, on_sent reports the total size
+        virtual send_result send(const shared_buffer_sequence_t &buffers) = 0;
+
+    protected:
+        // arms the receive loop again once a pause ended
+        virtual void _restart_receive() = 0;
 
     private:
         std::atomic_bool m_connected;
         std::atomic_bool m_healthy;
 
-        shared_buffer_t m_receive_buffer;
+        receive_buffer_holder m_receive_buffer;
+        receive_flow m_receive_flow;
+        send_backlog m_send_backlog;
 
         mutable std::mutex m_alias_mutex;
         std::string m_alias;
 
         client_callback_register m_callback_register;
 
+        event_notifier m_events;
+
     protected:
         shared_buffer_t receive_buffer()
         {
-            return this->m_receive_buffer;
+            return this->m_receive_buffer.current();
+        }
+
+        // buffer to give to the callbacks once bytes_transferred were received in receive_buffer()
+        shared_buffer_t take_receive_buffer(const size_t bytes_transferred)
+        {
+            return this->m_receive_buffer.take(bytes_transferred);
+        }
+
+        // asked by the receive loop before arming the next receive, false while paused
+        bool keep_receiving()
+        {
+            return this->m_receive_flow.keep_reading();
+        }
+
+        // a new connection starts its own receive loop
+        void restart_receive_flow()
+        {
+            this->m_receive_flow.restart();
+        }
+
+        // before handing `bytes` to the socket, the result of the send tells whether the backlog is over its high watermark
+        send_result queue_send_bytes(const size_t bytes)
+        {
+            return send_result(true, this->m_send_backlog.add(bytes));
+        }
+
+        // once the `bytes` of a queued send are written or failed, after its on_sent/on_send_error
+        void release_send_bytes(const size_t bytes)
+        {
+            if (this->m_send_backlog.remove(bytes))
+            {
+                HL_NET_LOG_DEBUG("Client: {} is writable again", this->get_alias());
+                this->callbacks_register().on_writable();
+            }
         }
 
     protected:
         base_abstract_client_unwrapped()
             : m_connected(false)
             , m_healthy(false)
-            , m_receive_buffer(make_shared_buffer())
+            , m_receive_buffer()
+            , m_receive_flow()
+            , m_send_backlog()
             , m_alias_mutex()
             , m_alias(fmt::format("base_abstract_client_unwrapped({})", static_cast<void *>(this)))
             , m_callback_register([this]() -> client_t { return this->as_sharable(); })
+            , m_events()
         {}
 
     public:
@@ -82,6 +140,100 @@ HL_NET_DIAGNOSTIC_POP()
             return this->m_callback_register;
         }
 
+        // notified on every connect or health status change
+        event_notifier& events()
+        {
+            return this->m_events;
+        }
+
+        // must be set before connect()
+        void set_receive_mode(const receive_mode mode)
+        {
+            this->m_receive_buffer.set_mode(mode);
+        }
+
+        receive_mode get_receive_mode() const
+        {
+            return this->m_receive_buffer.mode();
+        }
+
+        // must be set before connect()
+        void set_receive_buffer_provider(const buffer_provider_t &provider)
+        {
+            this->m_receive_buffer.set_provider(provider);
+        }
+
+        // stops arming receives once the one in flight completes, a tcp server is then held back by the tcp window
+        void pause_receive()
+        {
+            HL_NET_LOG_DEBUG("Pausing receive for client: {}", this->get_alias());
+            this->m_receive_flow.pause();
+        }
+
+        void resume_receive()
+        {
+            HL_NET_LOG_DEBUG("Resuming receive for client: {}", this->get_alias());
+            if (this->m_receive_flow.resume())
+            {
+                this->_restart_receive();
+            }
+        }
+
+        // by pause_receive() or by the async backlog
+        bool receive_paused() const
+        {
+            return this->m_receive_flow.paused();
+        }
+
+        // pauses the receive once `high` async callbacks wait to run, until they fall to `low` (0 disables it)
+        void set_receive_backlog(const size_t high, const size_t low)
+        {
+            this->m_receive_flow.set_backlog_marks(high, low);
+        }
+
+        // async callbacks posted and not run yet
+        size_t get_async_backlog() const
+        {
+            return this->m_receive_flow.async_backlog();
+        }
+
+        // called by the callback register around each async callback
+        void async_callback_posted()
+        {
+            this->m_receive_flow.async_posted();
+        }
+
+        void async_callback_done()
+        {
+            if (this->m_receive_flow.async_done())
+            {
+                HL_NET_LOG_DEBUG("Async backlog of client: {} drained, resuming receive", this->get_alias());
+                this->_restart_receive();
+            }
+        }
+
+        // the sends report over_watermark() once `high` bytes wait to be written, on_writable is called when they fall to `low`
+        void set_send_watermarks(const size_t high, const size_t low)
+        {
+            this->m_send_backlog.set_watermarks(high, low);
+        }
+
+        size_t get_send_high_watermark() const
+        {
+            return this->m_send_backlog.high_watermark();
+        }
+
+        size_t get_send_low_watermark() const
+        {
+            return this->m_send_backlog.low_watermark();
+        }
+
+        // bytes given to send and not written yet
+        size_t get_queued_send_bytes() const
+        {
+            return this->m_send_backlog.bytes();
+        }
+
         bool connected(void) const
         {
             return this->m_connected;
@@ -96,40 +248,43 @@ HL_NET_DIAGNOSTIC_POP()
         {
             this->m_connected = status;
             HL_NET_LOG_WARN("Client: {} connected status set to: {}", this->get_alias(), status);
+            this->m_events.notify();
         }
 
         void set_health_status(const bool status)
         {
             this->m_healthy = status;
             HL_NET_LOG_WARN("Client: {} health status set to: {}", this->get_alias(), status);
+            this->m_events.notify();
         }
 
-        bool send(const shared_buffer_t &buffer)
+        send_result send(const shared_buffer_t &buffer)
         {
             return this->send(buffer, buffer->size());
         }
 
-        bool send_bytes(const byte *data, const size_t &size)
+        send_result send_bytes(const byte *data, const size_t &size)
         {
             shared_buffer_t shared_buffer = make_shared_buffer(data, size);
             return this->send(shared_buffer, size);
         }
 
         template<typename T>
-        bool send_bytes(const std::vector<T> &data)
+        send_result send_bytes(const std::vector<T> &data)
         {
-            return this->send_bytes(static_cast<const byte *>(data.data()), data.size() * sizeof(T));
+            return this->send_bytes(reinterpret_cast<const byte *>(data.data()), data.size() * sizeof(T));
         }
 
-        bool send_string(const std::string &str)
+        send_result send_string(const std::string &str)
         {
             return this->send_bytes(reinterpret_cast<const byte *>(str.c_str()), str.size());
         }
 
         client_t as_sharable()
         {
-            HL_NET_LOG_CRITICAL("Asked for sharable client: {}", this->get_alias());
-            return shared_from_this();
+            HL_NET_LOG_TRACE("Asked for sharable client: {}", this->get_alias());
+            // null once the client is being destroyed
+            return weak_from_this().lock();
         }
     };
 
@@ -148,6 +303,8 @@ HL_NET_DIAGNOSTIC_POP()
             typename Protocol::socket socket;
             typename Protocol::resolver::iterator endpoint_iterator;
 
+            // keeps run() from returning while connected, even when no receive is pending
+            std::unique_ptr<boost::asio::io_service::work> io_service_work;
             std::thread io_service_thread;
 
             connection_data()
@@ -155,6 +312,7 @@ HL_NET_DIAGNOSTIC_POP()
                 , resolver(io_service)
                 , socket(io_service)
                 , endpoint_iterator()
+                , io_service_work()
                 , io_service_thread()
             {
             }
@@ -206,9 +364,111 @@ HL_NET_DIAGNOSTIC_POP()
         connection_data m_connection_data;
         std::mutex m_mutex_api_control_flow;
 
-        void _receive_async_callback(const boost::system::error_code& ec, const size_t &bytes_transferred, const shared_buffer_t &buffer)
+        // udp only, applied by connect()
+        std::atomic<size_t> m_udp_segment_size;
+        std::atomic_bool m_udp_gro;
+        // of the connected udp socket
+        size_t m_udp_socket_segment_size;
+        std::atomic_bool m_udp_gso; // the kernel splits the segmented sends
+        bool m_udp_socket_gro;
+        shared_buffer_t m_gro_buffer;
+        std::vector<char> m_gro_control;
+
+        // tcp only: a buffer or a sequence waiting for its turn to be written
+        struct send_request final
+        {
+            shared_buffer_t buffer = nullptr;
+            size_t size = 0;
+            shared_buffer_sequence_holder_t sequence = nullptr;
+        };
+
+        // tcp only: filled by the senders, drained by the io thread one write at a time (asio forbids two
+        // async_write in flight on a stream, their bytes would interleave)
+        mpsc_queue<send_request> m_send_queue;
+        // held by the io thread while a write is in flight, taken by the sender that finds it free
+        std::atomic_bool m_send_scheduled;
+        // messages of the write in flight and their buffers, io thread only
+        std::vector<send_request> m_write_batch;
+        std::vector<boost::asio::const_buffer> m_write_views;
+
+        template<typename P = Protocol, utils::enable_if_t<utils::is_same<P, boost::asio::ip::tcp>::value>* = nullptr>
+        inline void _setup_socket_protocol()
+        {
+        }
+
+        template<typename P = Protocol, utils::enable_if_t<utils::is_same<P, boost::asio::ip::udp>::value>* = nullptr>
+        inline void _setup_socket_protocol()
+        {
+            m_udp_socket_segment_size = m_udp_segment_size;
+            m_udp_gso = false;
+            m_udp_socket_gro = false;
+#if HL_NET_HAS_UDP_GSO
+            const int fd = m_connection_data.socket.native_handle();
+            m_udp_gso = m_udp_socket_segment_size && utils::set_udp_segment_size(fd, m_udp_socket_segment_size);
+            if (m_udp_gro && utils::set_udp_gro(fd, true))
+            {
+                m_udp_socket_gro = true;
+                m_gro_buffer = make_uninitialized_shared_buffer(HL_NET_UDP_GRO_BUFFER_SIZE);
+                m_gro_control.assign(utils::UDP_GRO_CONTROL_SIZE, 0);
+            }
+#endif
+            if (m_udp_socket_segment_size && !m_udp_gso)
+            {
+                HL_NET_LOG_WARN("UDP_SEGMENT is not supported, the segmented sends are split by client: {}", this->get_alias());
+            }
+            if (m_udp_gro && !m_udp_socket_gro)
+            {
+                HL_NET_LOG_WARN("UDP_GRO is not supported, every datagram is received alone by client: {}", this->get_alias());
+            }
+        }
+
+#if HL_NET_HAS_UDP_GSO
+        // the socket is readable: one recvmsg may hold many datagrams coalesced by UDP_GRO, split before on_receive
+        void _receive_gro_callback(const boost::system::error_code &ec)
+        {
+            if (ec)
+            {
+                this->_receive_async_callback(ec, 0);
+                return;
+            }
+
+            iovec vector = { m_gro_buffer->data(), m_gro_buffer->capacity() };
+            msghdr message = msghdr();
+            message.msg_iov = &vector;
+            message.msg_iovlen = 1;
+            message.msg_control = m_gro_control.data();
+            message.msg_controllen = m_gro_control.size();
+
+            const ssize_t received = ::recvmsg(m_connection_data.socket.native_handle(), &message, MSG_DONTWAIT);
+            if (received < 0)
+            {
+                const boost::system::error_code error(errno, boost::system::system_category());
+                if (error != boost::asio::error::would_block && error != boost::asio::error::interrupted)
+                {
+                    this->_receive_async_callback(error, 0);
+                }
+                else if (this->keep_receiving())
+                {
+                    this->_receive_async();
+                }
+                return;
+            }
+
+            HL_NET_LOG_DEBUG("Received {} bytes for client: {}", received, this->get_alias());
+            utils::for_each_udp_segment(static_cast<size_t>(received), utils::udp_gro_segment_size(message), [this](const size_t offset, const size_t length) {
+                shared_buffer_t buffer_cpy = make_shared_buffer(m_gro_buffer->data() + offset, length);
+                this->callbacks_register().on_receive(buffer_cpy, length);
+            });
+            if (this->keep_receiving())
+            {
+                this->_receive_async();
+            }
+        }
+#endif
+
+        void _receive_async_callback(const boost::system::error_code& ec, const size_t &bytes_transferred)
         {
-            shared_buffer_t buffer_cpy = make_shared_buffer(buffer, bytes_transferred);
+            shared_buffer_t buffer_cpy = this->take_receive_buffer(bytes_transferred);
 
             HL_NET_LOG_DEBUG("Received {} bytes for client: {}", bytes_transferred, this->get_alias());
             if (ec)
@@ -228,7 +488,10 @@ HL_NET_DIAGNOSTIC_POP()
             {
                 this->callbacks_register().on_receive(buffer_cpy, bytes_transferred);
             }
-            this->_receive_async();
+            if (this->keep_receiving())
+            {
+                this->_receive_async();
+            }
         }
 
         void _receive_async()
@@ -247,12 +510,25 @@ HL_NET_DIAGNOSTIC_POP()
 
             HL_NET_LOG_TRACE("Start reading for client: {}", this->get_alias());
 
+#if HL_NET_HAS_UDP_GSO
+            if (m_udp_socket_gro)
+            {
+                m_connection_data.socket.async_wait(Protocol::socket::wait_read,
+                    [this](const boost::system::error_code &ec) -> void
+                    {
+                        this->_receive_gro_callback(ec);
+                    }
+                );
+                return;
+            }
+#endif
+
             m_connection_data.socket.async_receive(
-                boost::asio::buffer(*recv_buffer),
-                [this, recv_buffer]
+                boost::asio::buffer(recv_buffer->data(), recv_buffer->capacity()),
+                [this]
                 (const boost::system::error_code &ec, const size_t &bytes_transferred) -> void
                 {
-                    this->_receive_async_callback(ec, bytes_transferred, recv_buffer);
+                    this->_receive_async_callback(ec, bytes_transferred);
                 }
             );
         }
@@ -260,6 +536,17 @@ HL_NET_DIAGNOSTIC_POP()
         base_client_unwrapped()
             : m_connection_data()
             , m_mutex_api_control_flow()
+            , m_udp_segment_size(0)
+            , m_udp_gro(false)
+            , m_udp_socket_segment_size(0)
+            , m_udp_gso(false)
+            , m_udp_socket_gro(false)
+            , m_gro_buffer()
+            , m_gro_control()
+            , m_send_queue()
+            , m_send_scheduled(false)
+            , m_write_batch()
+            , m_write_views()
         {
             HL_NET_LOG_TRACE("Created base_client_unwrapped: {}", this->get_alias());
         }
@@ -267,12 +554,8 @@ HL_NET_DIAGNOSTIC_POP()
         void basic_io_service_coroutine()
         {
             HL_NET_LOG_TRACE("Starting io_service coroutine for: {}", get_alias());
-            while (healthy())
-            {
-                m_connection_data.io_service.run();
-                HL_NET_LOG_TRACE("Restarting io_service coroutine for: {}", get_alias());
-                m_connection_data.io_service.reset();
-            }
+            // io_service_work keeps run() from returning until disconnect()
+            m_connection_data.io_service.run();
             HL_NET_LOG_TRACE("Stopping io_service coroutine for: {}", get_alias());
         }
 
@@ -293,6 +576,28 @@ HL_NET_DIAGNOSTIC_POP()
             HL_NET_LOG_TRACE("Destroyed base_client_unwrapped: {}", this->get_alias());
         }
 
+        // must be set before connect(): a send bigger than `segment_size` goes out as datagrams of that size (the last
+        // one shorter), written by the kernel with a single UDP_SEGMENT send when it supports it. 0 disables it.
+        template<typename P = Protocol, utils::enable_if_t<utils::is_same<P, boost::asio::ip::udp>::value>* = nullptr>
+        bool set_udp_segment_size(const size_t segment_size)
+        {
+            if (segment_size > HL_NET_UDP_MAX_PAYLOAD)
+            {
+                HL_NET_LOG_ERROR("Invalid udp segment size: {} for client: {}", segment_size, this->get_alias());
+                return false;
+            }
+            m_udp_segment_size = segment_size;
+            return true;
+        }
+
+        // must be set before connect(): the kernel may coalesce the datagrams of the server in one receive (UDP_GRO),
+        // they are split again before on_receive. Their buffers are then always copies, whatever the receive mode.
+        template<typename P = Protocol, utils::enable_if_t<utils::is_same<P, boost::asio::ip::udp>::value>* = nullptr>
+        void set_udp_gro(const bool enabled)
+        {
+            m_udp_gro = enabled;
+        }
+
         virtual bool connect(const std::string &host, const std::string &port) override final
         {
             {
@@ -311,6 +616,7 @@ HL_NET_DIAGNOSTIC_POP()
                     HL_NET_LOG_ERROR("Error connecting client: {} with error: {}", this->get_alias(), error.message());
                     return false;
                 }
+                this->_setup_socket_protocol<Protocol>();
 
                 client_callback_register &callback_register = this->callbacks_register();
 
@@ -318,34 +624,47 @@ HL_NET_DIAGNOSTIC_POP()
                 this->set_connect_status(true);
                 this->set_health_status(true);
 
+                // stopped by the previous disconnect()
+                this->m_connection_data.io_service.restart();
+                this->m_connection_data.io_service_work.reset(new boost::asio::io_service::work(this->m_connection_data.io_service));
                 this->m_connection_data.io_service_thread = std::thread(std::bind(&this_type_t::basic_io_service_coroutine, this));
 
                 callback_register.on_connect();
                 HL_NET_LOG_DEBUG("Connected client: {}", this->get_alias());
             }
 
-            this->_receive_async();
+            this->restart_receive_flow();
+            if (this->keep_receiving())
+            {
+                this->_receive_async();
+            }
             return true;
         }
 
         virtual bool disconnect() override final
         {
-            std::lock_guard<std::mutex> lock(this->m_mutex_api_control_flow);
+            {
+                std::lock_guard<std::mutex> lock(this->m_mutex_api_control_flow);
 
-            HL_NET_LOG_DEBUG("Disconnecting client: {}", this->get_alias());
+                HL_NET_LOG_DEBUG("Disconnecting client: {}", this->get_alias());
 
-            if (this->connected() == false)
-            {
-                HL_NET_LOG_WARN("Client already disconnected: {}", this->get_alias());
-                this->callbacks_register().on_disconnect_error(boost::asio::error::not_connected);
-                return false;
-            }
+                if (this->connected() == false)
+                {
+                    HL_NET_LOG_WARN("Client already disconnected: {}", this->get_alias());
+                    this->callbacks_register().on_disconnect_error(boost::asio::error::not_connected);
+                    return false;
+                }
+
+                this->set_health_status(false);
 
-            this->set_health_status(false);
+                this->m_connection_data.socket.close();
+                this->m_connection_data.io_service_work.reset();
+                this->m_connection_data.io_service.stop();
+            }
 
-            this->m_connection_data.socket.close();
-            this->m_connection_data.io_service.stop();
+            // joined without the lock, the cancelled receive handler takes it before noticing the client is not healthy
             this->m_connection_data.io_service_thread.join();
+            this->_drop_queued_sends();
 
             client_callback_register &callback_register = this->callbacks_register();
 
@@ -360,8 +679,17 @@ HL_NET_DIAGNOSTIC_POP()
             return true;
         }
     
+    protected:
+        void _restart_receive() override final
+        {
+            if (this->healthy())
+            {
+                this->_receive_async();
+            }
+        }
+
     private:
-        void _send_async_callback(const boost::system::error_code &ec, size_t bytes_transferred)
+        void _send_async_callback(const boost::system::error_code &ec, size_t bytes_transferred, const size_t size)
         {
             HL_NET_LOG_DEBUG("Sent {} bytes for client: {}", bytes_transferred, this->get_alias());
 
@@ -384,35 +712,231 @@ HL_NET_DIAGNOSTIC_POP()
             {
                 this->callbacks_register().on_sent(bytes_transferred);
             }
+            this->release_send_bytes(size);
+        }
+
+        // io thread: reports each message of the completed write, then starts the next one
+        void _on_batch_written(const boost::system::error_code &ec, const size_t bytes_transferred)
+        {
+            size_t remaining = bytes_transferred;
+            for (const send_request &request : m_write_batch)
+            {
+                const size_t size = request.sequence ? request.sequence->size : request.size;
+                const bool sent = !ec || remaining >= size;
+                const size_t written = sent ? size : remaining;
+                remaining -= written;
+                this->_send_async_callback(sent ? boost::system::error_code() : ec, written, size);
+            }
+            m_write_batch.clear();
+            m_write_views.clear();
+            _write_next_batch();
+        }
+
+        // io thread with m_send_scheduled held: gathers the queued messages in a single write whose completion
+        // starts the next one, releases the queue once it is empty
+        void _write_next_batch()
+        {
+            while (true)
+            {
+                size_t bytes = 0;
+                send_request request;
+                while (m_write_views.size() < HL_NET_TCP_MAX_WRITE_BUFFERS && bytes < HL_NET_TCP_MAX_WRITE_BYTES && m_send_queue.unsafe_pop(request))
+                {
+                    if (request.sequence)
+                    {
+                        m_write_views.insert(m_write_views.end(), request.sequence->views.begin(), request.sequence->views.end());
+                        bytes += request.sequence->size;
+                    }
+                    else
+                    {
+                        m_write_views.emplace_back(request.buffer->data(), request.size);
+                        bytes += request.size;
+                    }
+                    m_write_batch.push_back(std::move(request));
+                }
+
+                if (!m_write_batch.empty())
+                {
+                    // async_write loops on the partial writes until every byte of the batch is written
+                    boost::asio::async_write(
+                        this->m_connection_data.socket,
+                        m_write_views,
+                        [this](const boost::system::error_code &ec, const size_t bytes_transferred) -> void
+                        {
+                            this->_on_batch_written(ec, bytes_transferred);
+                        }
+                    );
+                    return;
+                }
+
+                if (!m_send_queue.unsafe_empty())
+                {
+                    // a sender is linking its request, retry after the other handlers
+                    boost::asio::post(this->m_connection_data.io_service, [this]() { this->_write_next_batch(); });
+                    return;
+                }
+                m_send_scheduled = false;
+                // a request pushed before the release was not seen by its sender as needing a write
+                if (m_send_queue.unsafe_empty() || m_send_scheduled.exchange(true))
+                {
+                    return;
+                }
+            }
+        }
+
+        // the sender that finds the queue idle hands it to the io thread, the others only push
+        void _queue_send(send_request request)
+        {
+            m_send_queue.push(std::move(request));
+            if (!m_send_scheduled.exchange(true))
+            {
+                boost::asio::dispatch(this->m_connection_data.io_service, [this]() { this->_write_next_batch(); });
+            }
+        }
+
+        // io thread joined: the messages still queued were meant for the closed socket, the write in flight is
+        // reported by its cancelled completion once the io_service runs again
+        void _drop_queued_sends()
+        {
+            send_request request;
+            while (m_send_queue.unsafe_pop(request))
+            {
+                const size_t size = request.sequence ? request.sequence->size : request.size;
+                this->_send_async_callback(boost::asio::error::operation_aborted, 0, size);
+            }
         }
 
         template<typename P = Protocol, utils::enable_if_t<utils::is_same<P, boost::asio::ip::tcp>::value>* = nullptr>
         inline void _send_async_protocol(const shared_buffer_t &buffer, const size_t &size)
         {
-            this->m_connection_data.socket.async_send(
-                boost::asio::buffer(*buffer, size),
-                [this, buffer](const boost::system::error_code &ec, const size_t &bytes_transferred) -> void
+            send_request request;
+            request.buffer = buffer;
+            request.size = size;
+            _queue_send(std::move(request));
+        }
+
+        // the send is split in datagrams by the client itself
+        bool _udp_split(const size_t size) const
+        {
+            return m_udp_socket_segment_size && !m_udp_gso && size > m_udp_socket_segment_size;
+        }
+
+        // a device without checksum offload makes the kernel fail the segmented sends with EIO, they are split by the client from then on
+        bool _udp_segmentation_refused(const boost::system::error_code &ec, const size_t size)
+        {
+            if (!m_udp_gso || size <= m_udp_socket_segment_size || ec != boost::system::errc::io_error)
+            {
+                return false;
+            }
+            HL_NET_LOG_WARN("UDP_SEGMENT refused by the kernel, the segmented sends are split by client: {}", this->get_alias());
+            m_udp_gso = false;
+#if HL_NET_HAS_UDP_GSO
+            utils::set_udp_segment_size(this->m_connection_data.socket.native_handle(), 0);
+#endif
+            return true;
+        }
+
+        // one async_send_to per segment, the send is reported once they all completed
+        template<typename ConstBufferSequence, typename KeepAlive>
+        void _send_segments_async(const ConstBufferSequence &views, const size_t size, const KeepAlive &keep_alive)
+        {
+            struct segments_state final
+            {
+                size_t pending;
+                size_t sent;
+                boost::system::error_code ec;
+
+                explicit segments_state(const size_t segments)
+                    : pending(segments)
+                    , sent(0)
+                    , ec()
+                {}
+            };
+            const boost::shared_ptr<segments_state> state = boost::make_shared<segments_state>(utils::udp_segment_count(size, m_udp_socket_segment_size));
+
+            for (size_t offset = 0; offset < size; offset += m_udp_socket_segment_size)
+            {
+                std::vector<boost::asio::const_buffer> segment;
+                utils::for_each_view_in_range(views, offset, std::min(m_udp_socket_segment_size, size - offset), [&segment](const byte *data, const size_t bytes) {
+                    segment.emplace_back(data, bytes);
+                });
+                this->m_connection_data.socket.async_send_to(
+                    segment,
+                    *this->m_connection_data.endpoint_iterator,
+                    [this, state, keep_alive, size](const boost::system::error_code &ec, const size_t &bytes_transferred) -> void
+                    {
+                        state->sent += bytes_transferred;
+                        if (ec && !state->ec)
+                        {
+                            state->ec = ec;
+                        }
+                        if (--state->pending == 0)
+                        {
+                            this->_send_async_callback(state->ec, state->sent, size);
+                        }
+                    }
+                );
+            }
+        }
+
+        template<typename P = Protocol, utils::enable_if_t<utils::is_same<P, boost::asio::ip::udp>::value>* = nullptr>
+        inline void _send_async_protocol(const shared_buffer_t &buffer, const size_t &size)
+        {
+            const std::array<boost::asio::const_buffer, 1> views = {{ boost::asio::buffer(buffer->data(), size) }};
+            if (this->_udp_split(size))
+            {
+                this->_send_segments_async(views, size, buffer);
+                return;
+            }
+            this->m_connection_data.socket.async_send_to(
+                views,
+                *this->m_connection_data.endpoint_iterator,
+                [this, views, buffer, size](const boost::system::error_code &ec, const size_t &bytes_transferred) -> void
                 {
-                    this->_send_async_callback(ec, bytes_transferred);
+                    if (this->_udp_segmentation_refused(ec, size))
+                    {
+                        this->_send_segments_async(views, size, buffer);
+                        return;
+                    }
+                    this->_send_async_callback(ec, bytes_transferred, size);
                 }
             );
         }
 
+        template<typename P = Protocol, utils::enable_if_t<utils::is_same<P, boost::asio::ip::tcp>::value>* = nullptr>
+        inline void _send_async_protocol(const shared_buffer_sequence_holder_t &sequence)
+        {
+            send_request request;
+            request.sequence = sequence;
+            request.size = sequence->size;
+            _queue_send(std::move(request));
+        }
+
         template<typename P = Protocol, utils::enable_if_t<utils::is_same<P, boost::asio::ip::udp>::value>* = nullptr>
-        inline void _send_async_protocol(const shared_buffer_t &buffer, const size_t &size)
+        inline void _send_async_protocol(const shared_buffer_sequence_holder_t &sequence)
         {
+            if (this->_udp_split(sequence->size))
+            {
+                this->_send_segments_async(sequence->views, sequence->size, sequence);
+                return;
+            }
             this->m_connection_data.socket.async_send_to(
-                boost::asio::buffer(*buffer, size),
+                sequence->views,
                 *this->m_connection_data.endpoint_iterator,
-                [this, buffer](const boost::system::error_code &ec, const size_t &bytes_transferred) -> void
+                [this, sequence](const boost::system::error_code &ec, const size_t &bytes_transferred) -> void
                 {
-                    this->_send_async_callback(ec, bytes_transferred);
+                    if (this->_udp_segmentation_refused(ec, sequence->size))
+                    {
+                        this->_send_segments_async(sequence->views, sequence->size, sequence);
+                        return;
+                    }
+                    this->_send_async_callback(ec, bytes_transferred, sequence->size);
                 }
             );
         }
 
     public:
-        virtual bool send(const shared_buffer_t &buffer, const size_t &size) override final
+        virtual send_result send(const shared_buffer_t &buffer, const size_t &size) override final
         {
             std::lock_guard<std::mutex> lock(this->m_mutex_api_control_flow);
 
@@ -442,12 +966,58 @@ HL_NET_DIAGNOSTIC_POP()
                 this->callbacks_register().on_send_error(boost::system::error_code(boost::asio::error::message_size), 0);
                 return false;
             }
+            else if (!utils::udp_segmentable(size, m_udp_socket_segment_size))
+            {
+                HL_NET_LOG_ERROR("Cannot send {} bytes in segments of {} bytes from client: {}", size, m_udp_socket_segment_size, this->get_alias());
+                this->callbacks_register().on_send_error(boost::system::error_code(boost::asio::error::message_size), 0);
+                return false;
+            }
             else
             {
                 HL_NET_LOG_DEBUG("Sending {} bytes for client: {}", size, this->get_alias());
+                const send_result result = this->queue_send_bytes(size);
                 _send_async_protocol<Protocol>(buffer, size);
-                return true;
+                return result;
+            }
+        }
+
+        virtual send_result send(const shared_buffer_sequence_t &buffers) override final
+        {
+            std::lock_guard<std::mutex> lock(this->m_mutex_api_control_flow);
+
+            HL_NET_LOG_TRACE("Preparing to send {} buffers for client: {}", buffers.size(), this->get_alias());
+
+            if (!healthy())
+            {
+                HL_NET_LOG_ERROR("Cannot send data to from a non-healthy client: {}", this->get_alias());
+                this->callbacks_register().on_send_error(boost::system::error_code(boost::asio::error::not_connected), 0);
+                return false;
+            }
+
+            const shared_buffer_sequence_holder_t sequence = make_shared_buffer_sequence_holder(buffers);
+            if (!sequence)
+            {
+                HL_NET_LOG_ERROR("Cannot send data from a null buffer client: {}", this->get_alias());
+                this->callbacks_register().on_send_error(boost::system::error_code(boost::asio::error::invalid_argument), 0);
+                return false;
             }
+            else if (!sequence->size)
+            {
+                HL_NET_LOG_ERROR("Cannot send 0 bytes to the client: {}", this->get_alias());
+                this->callbacks_register().on_send_error(boost::system::error_code(boost::asio::error::invalid_argument), 0);
+                return false;
+            }
+            else if (!utils::udp_segmentable(sequence->size, m_udp_socket_segment_size))
+            {
+                HL_NET_LOG_ERROR("Cannot send {} bytes in segments of {} bytes from client: {}", sequence->size, m_udp_socket_segment_size, this->get_alias());
+                this->callbacks_register().on_send_error(boost::system::error_code(boost::asio::error::message_size), 0);
+                return false;
+            }
+
+            HL_NET_LOG_DEBUG("Sending {} bytes in {} buffers for client: {}", sequence->size, buffers.size(), this->get_alias());
+            const send_result result = this->queue_send_bytes(sequence->size);
+            _send_async_protocol<Protocol>(sequence);
+            return result;
         }
     };
 
@@ -21,30 +21,35 @@ namespace net
 
         plugins::plugin_manager<plugins::client_plugin> m_plugins;
 
+        // state of wait_for_event(), only used by the thread waiting on it
+        event_notifier::generation_t m_seen_events;
+
     public:
         explicit client_wrapper()
             : m_shared_client(Protocol::make())
             , m_client(*this->m_shared_client)
             , m_plugins()
+            , m_seen_events(0)
         {
             HL_NET_LOG_TRACE("Creating client wrapper for: {}", this->get_alias());
 
 HL_NET_DIAGNOSTIC_PUSH()
 HL_NET_DIAGNOSTIC_UNUSED_PARAMETER_IGNORED()
             client_callbacks client_callbacks;
-            client_callbacks.on_connect_callback = HL_NET_CLIENT_ON_CONNECT(client) { HL_NET_LOG_INFO("Client connected: {}", client->get_alias()); };  
+            client_callbacks.on_connect_callback = HL_NET_CLIENT_ON_CONNECT(client) { HL_NET_LOG_INFO("Client connected: {}", client ? client->get_alias() : "nullclient"); };  
             client_callbacks.on_disconnect_callback = HL_NET_CLIENT_ON_DISCONNECT() { HL_NET_LOG_INFO("Client disconnected..."); };
             client_callbacks.on_disconnect_error_callback = HL_NET_CLIENT_ON_DISCONNECT_ERROR(ec) {
                 HL_NET_LOG_ERROR("Client disconnect error: {}", ec.message());
             };
-            client_callbacks.on_receive_callback = HL_NET_CLIENT_ON_RECEIVE(client, buffer_copy, recv_bytes) { HL_NET_LOG_INFO("Client received: {} - {}", client->get_alias(), recv_bytes); };
+            client_callbacks.on_receive_callback = HL_NET_CLIENT_ON_RECEIVE(client, buffer_copy, recv_bytes) { HL_NET_LOG_INFO("Client received: {} - {}", client ? client->get_alias() : "nullclient", recv_bytes); };
             client_callbacks.on_receive_error_callback = HL_NET_CLIENT_ON_RECEIVE_ERROR(client, buffer_copy, ec, recv_bytes) {
                 HL_NET_LOG_ERROR("Client receive error: {} - {} - {}", client ? client->get_alias() : "nullclient", ec.message(), recv_bytes);
             };
-            client_callbacks.on_sent_callback = HL_NET_CLIENT_ON_SENT(client, sent_bytes) { HL_NET_LOG_INFO("Client sent: {} - {}", client->get_alias(), sent_bytes); };
+            client_callbacks.on_sent_callback = HL_NET_CLIENT_ON_SENT(client, sent_bytes) { HL_NET_LOG_INFO("Client sent: {} - {}", client ? client->get_alias() : "nullclient", sent_bytes); };
             client_callbacks.on_send_error_callback = HL_NET_CLIENT_ON_SEND_ERROR(client, ec, sent_bytes) {
                 HL_NET_LOG_ERROR("Client send error: {} - {} - {}", client ? client->get_alias() : "nullclient", ec.message(), sent_bytes);
             };
+            client_callbacks.on_writable_callback = HL_NET_CLIENT_ON_WRITABLE(client) { HL_NET_LOG_INFO("Client can send again: {}", client ? client->get_alias() : "nullclient"); };
 HL_NET_DIAGNOSTIC_POP()
 
             m_client.callbacks_register().add_layer(DEFAULT_REGISTER_LAYER, client_callbacks);
@@ -79,6 +84,48 @@ HL_NET_DIAGNOSTIC_POP()
             return this->m_client.connected();
         }
 
+        void set_receive_mode(const receive_mode mode)
+        {
+            this->m_client.set_receive_mode(mode);
+        }
+
+        void set_receive_buffer_provider(const buffer_provider_t &provider)
+        {
+            this->m_client.set_receive_buffer_provider(provider);
+        }
+
+        void set_send_watermarks(const size_t high, const size_t low)
+        {
+            this->m_client.set_send_watermarks(high, low);
+        }
+
+        // udp only
+        bool set_udp_segment_size(const size_t segment_size)
+        {
+            return this->m_client.set_udp_segment_size(segment_size);
+        }
+
+        // udp only
+        void set_udp_gro(const bool enabled)
+        {
+            this->m_client.set_udp_gro(enabled);
+        }
+
+        void set_receive_backlog(const size_t high, const size_t low)
+        {
+            this->m_client.set_receive_backlog(high, low);
+        }
+
+        void pause_receive()
+        {
+            this->m_client.pause_receive();
+        }
+
+        void resume_receive()
+        {
+            this->m_client.resume_receive();
+        }
+
         bool healthy() const
         {
             return this->m_client.healthy();
@@ -97,28 +144,33 @@ HL_NET_DIAGNOSTIC_POP()
             return this->m_client.disconnect();
         }
 
-        bool send(const shared_buffer_t &buffer)
+        send_result send(const shared_buffer_t &buffer)
         {
             return this->m_client.send(buffer);
         }
 
-        bool send(const shared_buffer_t &buffer, const size_t &size)
+        send_result send(const shared_buffer_t &buffer, const size_t &size)
         {
             return this->m_client.send(buffer, size);
         }
 
-        bool send_bytes(const void *data, const size_t &size)
+        send_result send(const shared_buffer_sequence_t &buffers)
+        {
+            return this->m_client.send(buffers);
+        }
+
+        send_result send_bytes(const void *data, const size_t &size)
         {
             return this->m_client.send_bytes(data, size);
         }
 
         template<typename T>
-        bool send_bytes(const std::vector<T> &data)
+        send_result send_bytes(const std::vector<T> &data)
         {
             return this->m_client.send_bytes(data);
         }
 
-        bool send_string(const std::string &str)
+        send_result send_string(const std::string &str)
         {
             return this->m_client.send_string(str);
         }
@@ -141,6 +193,32 @@ HL_NET_DIAGNOSTIC_POP()
             return this->healthy();
         }
 
+        // runs the task on the thread waiting in wait_for_event()
+        void post(const event_notifier::task_t &task)
+        {
+            this->m_client.events().post(task);
+        }
+
+        // Blocks until the client connects, disconnects or changes health, or until a task is posted (or timeout),
+        // then runs the posted tasks. Returns healthy() like update(), which does not update the plugins either.
+        bool wait_for_event(const std::chrono::milliseconds &timeout = std::chrono::milliseconds(HL_NET_DEFAULT_UPDATE_INTERVAL_MS))
+        {
+            const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+            for (const event_notifier::task_t &task : this->m_client.events().wait_until(deadline, this->m_seen_events))
+            {
+                task();
+            }
+            return this->healthy();
+        }
+
+        // returns once the client is no longer healthy (disconnected or failed)
+        void run_until_stopped()
+        {
+            while (this->wait_for_event())
+            {
+            }
+        }
+
     };
 }
 }
\ No newline at end of file
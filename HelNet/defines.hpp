@@ -5,20 +5,29 @@ Copyright: (C) 2024 Mattis DALLEAU
 
 #pragma once
 
+// The layers map is the source of truth and is only touched under CALLBACK_MUTEX, every change rebuilds the
+// handlers snapshots with _unsafe_rebuild_handlers() (provided by the register) so that the dispatch takes no lock.
 #define _HL_INTERNAL_CALLBACK_IMPL_BASE(CALLBACK_TYPE, POOL, CALLBACK_MUTEX, CALLBACKS) \
     void unsafe_start_pool(void) { POOL.start(); } \
     void unsafe_stop_pool(void) { POOL.stop(); } \
+    /* threads running the async callbacks, applied on the next start */ \
+    void set_async_threads(const size_t count) { POOL.set_threads(count); } \
+    callback_pool_stats get_async_stats(void) const { return POOL.stats(); } \
+    /* runs a task on the pool of the async callbacks, any idle worker may steal it */ \
+    void post_async(const callback_pool::task_t &task) { POOL.post(task); } \
     void add_layer(const std::string &layer, const CALLBACK_TYPE& callback=CALLBACK_TYPE()) \
     { \
         std::lock_guard<std::mutex> lock(CALLBACK_MUTEX); \
         HL_NET_LOG_INFO("Adding layer: {}", layer); \
         CALLBACKS[layer] = callback; \
+        _unsafe_rebuild_handlers(); \
     } \
     void remove_layer(const std::string &layer) \
     { \
         std::lock_guard<std::mutex> lock(CALLBACK_MUTEX); \
         HL_NET_LOG_INFO("Removing layer: {}", layer); \
         CALLBACKS.erase(layer); \
+        _unsafe_rebuild_handlers(); \
     } \
     std::vector<std::string> get_layers(void) const \
     { \
@@ -34,75 +43,92 @@ Copyright: (C) 2024 Mattis DALLEAU
     { \
         std::lock_guard<std::mutex> lock(CALLBACK_MUTEX); \
         CALLBACKS.clear(); \
+        _unsafe_rebuild_handlers(); \
         HL_NET_LOG_INFO("Cleared all layers"); \
     }
 
+// Finds the layer of a setter, the default layer is created on its first use
+#define _HL_INTERNAL_CALLBACK_REGISTER_FIND_LAYER(CALLBACKS, LAYER) \
+    auto it = CALLBACKS.find(LAYER); \
+    if (it == CALLBACKS.end() && LAYER == DEFAULT_REGISTER_LAYER) \
+    { \
+        HL_NET_LOG_INFO("Default Layer {} does not exist, creating it", LAYER); \
+        it = CALLBACKS.emplace(LAYER, decltype(CALLBACKS)::mapped_type()).first; \
+    }
+
 #define _HL_INTERNAL_CALLBACK_REGISTER_IMPL_SETTERS(NAME, CALLBACK_TYPE, CALLBACKS, POOL, MUTEX) \
     void set_##NAME(const CALLBACK_TYPE##_##NAME##_callback& NAME##_callback, const std::string &layer = DEFAULT_REGISTER_LAYER) \
     { \
-        std::lock_guard<std::mutex> lock(MUTEX, std::adopt_lock); \
-        auto it = CALLBACKS.find(layer); \
-        if (it != CALLBACKS.end()) \
-        { \
-            it->second.NAME##_callback = NAME##_callback; \
-            HL_NET_LOG_INFO("Callback {} set on layer {}", #NAME, layer); \
-        } \
-        else if (layer == DEFAULT_REGISTER_LAYER) \
-        { \
-            HL_NET_LOG_INFO("Default Layer {} does not exist, creating it", layer); \
-            add_layer(layer); \
-            set_##NAME(NAME##_callback, layer); \
-        } \
-        else \
+        std::lock_guard<std::mutex> lock(MUTEX); \
+        _HL_INTERNAL_CALLBACK_REGISTER_FIND_LAYER(CALLBACKS, layer) \
+        if (it == CALLBACKS.end()) \
         { \
             HL_NET_LOG_ERROR("Cannot set callback {} on layer {} because the layer does not exist", #NAME, layer); \
+            return; \
         } \
+        it->second.NAME##_callback = NAME##_callback; \
+        _unsafe_rebuild_##NAME##_handlers(); \
+        HL_NET_LOG_INFO("Callback {} set on layer {}", #NAME, layer); \
     } \
     \
     void set_##NAME##_async(bool async, const std::string &layer = DEFAULT_REGISTER_LAYER) \
     { \
-        std::lock_guard<std::mutex> lock(MUTEX, std::adopt_lock); \
-        auto it = CALLBACKS.find(layer); \
-        if (it != CALLBACKS.end()) \
-        { \
-            it->second.NAME##_is_async = async; \
-            HL_NET_LOG_INFO("Async set to {} for callback {} on layer {}", async, #NAME, layer); \
-        } \
-        else if (layer == DEFAULT_REGISTER_LAYER) \
-        { \
-            HL_NET_LOG_INFO("Default Layer {} does not exist, creating it", layer); \
-            add_layer(layer); \
-            set_##NAME##_async(async, layer); \
-        } \
-        else \
+        std::lock_guard<std::mutex> lock(MUTEX); \
+        _HL_INTERNAL_CALLBACK_REGISTER_FIND_LAYER(CALLBACKS, layer) \
+        if (it == CALLBACKS.end()) \
         { \
             HL_NET_LOG_ERROR("Cannot set async for callback {} on layer {} because the layer does not exist", #NAME, layer); \
+            return; \
         } \
+        it->second.NAME##_is_async = async; \
+        _unsafe_rebuild_##NAME##_handlers(); \
+        HL_NET_LOG_INFO("Async set to {} for callback {} on layer {}", async, #NAME, layer); \
     }
 
-// TODO: Fix this macro for callback async (Is sync for now)
+// Snapshot of the non-null NAME handlers, replaced under MUTEX and read by the dispatch without lock
+#define _HL_INTERNAL_CALLBACK_REGISTER_IMPL_HANDLERS(NAME, CALLBACK_TYPE, CALLBACKS) \
+private: \
+    callback_handlers_snapshot<CALLBACK_TYPE##_##NAME##_callback> m_##NAME##_handlers{}; \
+    \
+    void _unsafe_rebuild_##NAME##_handlers(void) \
+    { \
+        std::unique_ptr<callback_handlers_t<CALLBACK_TYPE##_##NAME##_callback>> handlers(new callback_handlers_t<CALLBACK_TYPE##_##NAME##_callback>()); \
+        for (const auto& layer : CALLBACKS) \
+        { \
+            if (layer.second.NAME##_callback) \
+            { \
+                handlers->push_back({layer.second.NAME##_callback, layer.second.NAME##_is_async}); \
+            } \
+        } \
+        m_##NAME##_handlers.unsafe_replace(std::move(handlers)); \
+    } \
+    \
+public:
+
+// Async callbacks are posted to POOL with a copy of the callback and of the (decayed) arguments,
+// the arguments are given as lvalues since every layer receives them.
+// The register must provide _async_key(args...), the callbacks with the same key are run in order,
+// and _async_task(task, args...) giving what is posted for the task (counted by its connection for instance).
 #define _HL_INTERNAL_CALLBACK_REGISTER_IMPL(NAME, CALLBACK_TYPE, CALLBACKS, POOL, MUTEX, GET_SHARABLE) \
+    _HL_INTERNAL_CALLBACK_REGISTER_IMPL_HANDLERS(NAME, CALLBACK_TYPE, CALLBACKS) \
     template<typename ...Args> void NAME(Args&&... args) \
     { \
-        std::lock_guard<std::mutex> lock(MUTEX, std::adopt_lock); \
+        const callback_handlers_snapshot<CALLBACK_TYPE##_##NAME##_callback>::reader handlers(m_##NAME##_handlers); \
+        if (handlers->empty()) \
+        { \
+            return; \
+        } \
         auto sharable = GET_SHARABLE(); \
         HL_NET_LOG_INFO("Calling sharable callback: {}", #NAME); \
-        for (const auto& layer  : CALLBACKS) \
+        for (const auto& handler : *handlers) \
         { \
-            const auto& callback_reg = layer.second; \
-            if (callback_reg.NAME##_callback) \
+            if (handler.is_async) \
             { \
-                const auto& callback = callback_reg.NAME##_callback; \
-                const bool& is_async = callback_reg.NAME##_is_async; \
-                if (is_async) \
-                { \
-                    HL_NET_LOG_WARN("Async callback not implemented yet will be called synchronously"); \
-                    callback(sharable, std::forward<Args>(args)...); \
-                } \
-                else \
-                { \
-                    callback(sharable, std::forward<Args>(args)...); \
-                } \
+                POOL.post(_async_key(args...), _async_task(std::bind(handler.callback, sharable, args...), args...)); \
+            } \
+            else \
+            { \
+                handler.callback(sharable, args...); \
             } \
         } \
         HL_NET_LOG_INFO("CallbackSharable: {} called", #NAME); \
@@ -110,32 +136,34 @@ Copyright: (C) 2024 Mattis DALLEAU
     _HL_INTERNAL_CALLBACK_REGISTER_IMPL_SETTERS(NAME, CALLBACK_TYPE, CALLBACKS, POOL, MUTEX)
 
 #define _HL_INTERNAL_CALLBACK_REGISTER_IMPL_NO_SHARABLE(NAME, CALLBACK_TYPE, CALLBACKS, POOL, MUTEX) \
+    _HL_INTERNAL_CALLBACK_REGISTER_IMPL_HANDLERS(NAME, CALLBACK_TYPE, CALLBACKS) \
     template<typename ...Args> void NAME(Args&&... args) \
     { \
-        std::lock_guard<std::mutex> lock(MUTEX, std::adopt_lock); \
+        const callback_handlers_snapshot<CALLBACK_TYPE##_##NAME##_callback>::reader handlers(m_##NAME##_handlers); \
+        if (handlers->empty()) \
+        { \
+            return; \
+        } \
         HL_NET_LOG_INFO("Calling non sharable callback: {}", #NAME); \
-        for (const auto& layer  : CALLBACKS) \
+        for (const auto& handler : *handlers) \
         { \
-            const auto& callback_reg = layer.second; \
-            if (callback_reg.NAME##_callback) \
+            if (handler.is_async) \
             { \
-                const auto& callback = callback_reg.NAME##_callback; \
-                const bool& is_async = callback_reg.NAME##_is_async; \
-                if (is_async) \
-                { \
-                    HL_NET_LOG_WARN("Async callback not implemented yet will be called synchronously"); \
-                    callback(std::forward<Args>(args)...); \
-                } \
-                else \
-                { \
-                    callback(std::forward<Args>(args)...); \
-                } \
+                POOL.post(_async_key(args...), _async_task(std::bind(handler.callback, args...), args...)); \
+            } \
+            else \
+            { \
+                handler.callback(args...); \
             } \
         } \
         HL_NET_LOG_INFO("NonSharableCallback: {} called", #NAME); \
     } \
     _HL_INTERNAL_CALLBACK_REGISTER_IMPL_SETTERS(NAME, CALLBACK_TYPE, CALLBACKS, POOL, MUTEX)
 
+// Rebuilds the handlers snapshot of one event, to be expanded with the events list of a register
+#define _HL_INTERNAL_CALLBACK_REGISTER_REBUILD_HANDLERS(NAME) \
+    _unsafe_rebuild_##NAME##_handlers();
+
 #define _HL_INTERNAL_UNHEALTHY_CASES_CLIENT \
     case boost::asio::error::eof: \
     case boost::asio::error::connection_reset: \
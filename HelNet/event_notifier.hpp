@@ -0,0 +1,82 @@
+/*
+This code is licensed under the GNU GPL v3.
+Copyright: (C) 2024 Mattis DALLEAU
+*/
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include <hl/silva/collections/meta.hpp>
+
+// Period of the plugins updates done by the wrappers wait_for_event()
+#ifndef HL_NET_DEFAULT_UPDATE_INTERVAL_MS
+    #define HL_NET_DEFAULT_UPDATE_INTERVAL_MS 100
+#endif
+
+namespace hl
+{
+namespace net
+{
+    // Wakes up the thread waiting in the wrappers wait_for_event() when the state of a server or client changes
+    // or when a task is posted to be run by that thread.
+    // Every notification bumps a generation, a waiter only sleeps while the generation is the one it last saw
+    // so that no notification sent between two waits is lost.
+    class event_notifier final : public hl::silva::collections::meta::NonCopyMoveable
+    {
+    public:
+        using task_t = std::function<void(void)>;
+        using tasks_t = std::vector<task_t>;
+        using generation_t = std::uint64_t;
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        generation_t m_generation;
+        tasks_t m_tasks;
+
+    public:
+        event_notifier()
+            : m_mutex()
+            , m_cv()
+            , m_generation(0)
+            , m_tasks()
+        {}
+
+        ~event_notifier() = default;
+
+        void notify()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_generation;
+            m_cv.notify_all();
+        }
+
+        void post(const task_t &task)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks.push_back(task);
+            ++m_generation;
+            m_cv.notify_all();
+        }
+
+        // waits for a notification newer than seen or for the deadline, updates seen and returns the posted tasks
+        template<typename Clock, typename Duration>
+        tasks_t wait_until(const std::chrono::time_point<Clock, Duration> &deadline, generation_t &seen)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait_until(lock, deadline, [this, &seen]() -> bool { return m_generation != seen; });
+            seen = m_generation;
+
+            tasks_t tasks;
+            tasks.swap(m_tasks);
+            return tasks;
+        }
+    };
+}
+}
@@ -0,0 +1,98 @@
+/*
+This code is licensed under the GNU GPL v3.
+Copyright: (C) 2024 Mattis DALLEAU
+*/
+
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+#include <hl/silva/collections/meta.hpp>
+
+namespace hl
+{
+namespace net
+{
+    // Unbounded lock-free queue with any number of producers and a single consumer (intrusive linked list with a stub node).
+    // push() is one exchange, never waits for another producer nor for the consumer.
+    // A push is visible to the consumer once its producer linked it: until then unsafe_pop() fails while
+    // unsafe_empty() already reports the queue as not empty.
+    template<typename T>
+    class mpsc_queue final : public hl::silva::collections::meta::NonCopyMoveable
+    {
+    public:
+        using value_type = T;
+
+    private:
+        struct node final : public hl::silva::collections::meta::NonCopyMoveable
+        {
+            std::atomic<node*> next;
+            value_type value;
+
+            node()
+                : next(nullptr)
+                , value()
+            {}
+
+            explicit node(value_type &&moved)
+                : next(nullptr)
+                , value(std::move(moved))
+            {}
+        };
+
+        std::atomic<node*> m_head;  // last pushed, producers only
+        node *m_tail;               // stub whose next is the first value, consumer only
+
+    public:
+        mpsc_queue()
+            : m_head(nullptr)
+            , m_tail(new node())
+        {
+            m_head = m_tail;
+        }
+
+        mpsc_queue(const mpsc_queue &) = delete;
+        mpsc_queue& operator=(const mpsc_queue &) = delete;
+
+        ~mpsc_queue()
+        {
+            while (m_tail)
+            {
+                node *next = m_tail->next.load();
+                delete m_tail;
+                m_tail = next;
+            }
+        }
+
+        void push(value_type value)
+        {
+            node *pushed = new node(std::move(value));
+            node *previous = m_head.exchange(pushed);
+            previous->next.store(pushed, std::memory_order_release);
+        }
+
+        // consumer only, false when empty or when the first value is not linked yet
+        bool unsafe_pop(value_type &value)
+        {
+            node *next = m_tail->next.load(std::memory_order_acquire);
+            if (!next)
+            {
+                return false;
+            }
+            value = std::move(next->value);
+            next->value = value_type();
+            delete m_tail;
+            m_tail = next;
+            return true;
+        }
+
+        // consumer only, sequentially consistent with push() so that a consumer giving up after an empty check
+        // is ordered with the producers that pushed before it
+        bool unsafe_empty() const
+        {
+            return m_head.load() == m_tail;
+        }
+    };
+}
+}
@@ -5,6 +5,9 @@ Copyright: (C) 2024 Mattis DALLEAU
 
 #pragma once
 
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/strand.hpp>
+
 #include "HelNet/server/callbacks.hpp"
 
 namespace hl
@@ -13,6 +16,10 @@ namespace net
 {
     using client_is_unhealthy_notifier_t = std::function<void(const client_id_t&)>;
     using server_is_unhealthy_notifier_t = std::function<void(void)>;
+    // called once an asynchronous send is over, after the on_sent/on_send_error callbacks
+    using send_completion_t = std::function<void(const boost::system::error_code&, const size_t)>;
+    // serializes the operations and handlers of a socket when the io_service runs on several threads
+    using io_strand_t = boost::asio::strand<boost::asio::io_service::executor_type>;
 
 HL_NET_DIAGNOSTIC_PUSH()
 HL_NET_DIAGNOSTIC_NON_VIRTUAL_DESTRUCTOR_IGNORED()
@@ -23,16 +30,27 @@ HL_NET_DIAGNOSTIC_POP()
         using shared_t = boost::shared_ptr<base_abstract_connection_unwrapped>;
 
         virtual bool stop() = 0;
-        virtual bool send(const shared_buffer_t &buffer, const size_t &size) = 0;
+        virtual send_result send(const shared_buffer_t &buffer, const size_t &size) = 0;
+        // completion is not called when false is returned
+        virtual send_result send(const shared_buffer_t &buffer, const size_t &size, const send_completion_t &completion) = 0;
+        // sends every piece as one message with a single scatter-gather system call, on_sent reports the total size
+        virtual send_result send(const shared_buffer_sequence_t &buffers) = 0;
+
+    protected:
+        // arms the receive loop again once a pause ended, nothing for the connections without their own loop
+        virtual void _restart_receive() {}
 
     private:
         server_callback_register &m_callback_register;
-        shared_buffer_t m_receive_buffer;
+        receive_buffer_holder m_receive_buffer;
+        receive_flow m_receive_flow;
 
-        std::string m_alias;
+        mutable std::string m_alias;
         mutable std::mutex m_alias_mutex;
 
         atomic_client_id m_id;
+        std::atomic<sent_notification> m_sent_notification;
+        send_backlog m_send_backlog;
         std::atomic_bool m_healthy;
         std::atomic_bool m_running;
 
@@ -42,7 +60,19 @@ HL_NET_DIAGNOSTIC_POP()
     protected:
         shared_buffer_t receive_buffer()
         {
-            return m_receive_buffer;
+            return m_receive_buffer.current();
+        }
+
+        // buffer to give to the callbacks once bytes_transferred were received in receive_buffer()
+        shared_buffer_t take_receive_buffer(const size_t bytes_transferred)
+        {
+            return m_receive_buffer.take(bytes_transferred);
+        }
+
+        // asked by the receive loop before arming the next receive, false while paused
+        bool keep_receiving()
+        {
+            return m_receive_flow.keep_reading();
         }
 
         void set_run_status(const bool status)
@@ -57,6 +87,14 @@ HL_NET_DIAGNOSTIC_POP()
             m_healthy = status;
         }
 
+        // for the constructors: set_run_status/set_health_status log get_alias(), which would build and keep the
+        // alias of an object whose _default_alias() is not the final one yet
+        void _init_status(const bool running, const bool healthy)
+        {
+            m_running = running;
+            m_healthy = healthy;
+        }
+
         void notify_server_as_unhealthy()
         {
             m_notify_server_as_unhealthy();
@@ -67,15 +105,130 @@ HL_NET_DIAGNOSTIC_POP()
             m_notify_client_as_unhealthy_to_the_server(get_id());
         }
 
+        // before handing `bytes` to the socket, the result of the send tells whether the backlog is over its high watermark
+        send_result queue_send_bytes(const size_t bytes)
+        {
+            return send_result(true, m_send_backlog.add(bytes));
+        }
+
+        // once the `bytes` of a queued send are written or failed, after its on_sent/on_send_error
+        void release_send_bytes(const connection_t &connexion, const size_t bytes)
+        {
+            if (m_send_backlog.remove(bytes))
+            {
+                HL_NET_LOG_DEBUG("Connection: {} is writable again", get_alias());
+                callbacks_register().on_writable(connexion);
+            }
+        }
+
     public:
         server_callback_register& callbacks_register()
         {
             return m_callback_register;
         }
 
+        // must be set before the connection starts receiving
+        void set_receive_mode(const receive_mode mode)
+        {
+            m_receive_buffer.set_mode(mode);
+        }
+
+        // must be set before the connection starts receiving
+        void set_receive_buffer_provider(const buffer_provider_t &provider)
+        {
+            m_receive_buffer.set_provider(provider);
+        }
+
+        // stops arming receives once the one in flight completes, the peer is then held back by the tcp window
+        // (the udp connections share the socket of their server and keep receiving)
+        void pause_receive()
+        {
+            HL_NET_LOG_DEBUG("Pausing receive for connection: {}", get_alias());
+            m_receive_flow.pause();
+        }
+
+        void resume_receive()
+        {
+            HL_NET_LOG_DEBUG("Resuming receive for connection: {}", get_alias());
+            if (m_receive_flow.resume())
+            {
+                _restart_receive();
+            }
+        }
+
+        // by pause_receive() or by the async backlog
+        bool receive_paused() const
+        {
+            return m_receive_flow.paused();
+        }
+
+        // pauses the receive once `high` async callbacks of the connection wait to run, until they fall to `low` (0 disables it)
+        void set_receive_backlog(const size_t high, const size_t low)
+        {
+            m_receive_flow.set_backlog_marks(high, low);
+        }
+
+        // async callbacks of the connection posted and not run yet
+        size_t get_async_backlog() const
+        {
+            return m_receive_flow.async_backlog();
+        }
+
+        // called by the callback register around each async callback of the connection
+        void async_callback_posted()
+        {
+            m_receive_flow.async_posted();
+        }
+
+        void async_callback_done()
+        {
+            if (m_receive_flow.async_done())
+            {
+                HL_NET_LOG_DEBUG("Async backlog of connection: {} drained, resuming receive", get_alias());
+                _restart_receive();
+            }
+        }
+
+        // only used by the connections gathering their messages (tcp)
+        void set_sent_notification(const sent_notification notification)
+        {
+            m_sent_notification = notification;
+        }
+
+        sent_notification get_sent_notification() const
+        {
+            return m_sent_notification;
+        }
+
+        // the sends report over_watermark() once `high` bytes wait to be written, on_writable is called when they fall to `low`
+        void set_send_watermarks(const size_t high, const size_t low)
+        {
+            m_send_backlog.set_watermarks(high, low);
+        }
+
+        size_t get_send_high_watermark() const
+        {
+            return m_send_backlog.high_watermark();
+        }
+
+        size_t get_send_low_watermark() const
+        {
+            return m_send_backlog.low_watermark();
+        }
+
+        // bytes given to send and not written yet
+        size_t get_queued_send_bytes() const
+        {
+            return m_send_backlog.bytes();
+        }
+
         std::string get_alias() const
         {
             std::lock_guard<std::mutex> lock(m_alias_mutex);
+            if (m_alias.empty())
+            {
+                m_alias = _default_alias();
+            }
             return m_alias;
         }
 
@@ -113,27 +266,36 @@ HL_NET_DIAGNOSTIC_POP()
         }
 
     protected:
+        // alias of a connection that was not given one, built the first time it is asked for
+        virtual std::string _default_alias() const
+        {
+            return fmt::format("base_abstract_connection_unwrapped({})", static_cast<const void*>(this));
+        }
+
         base_abstract_connection_unwrapped(server_callback_register &callback_register,
                                             const server_is_unhealthy_notifier_t& notify_server_as_unhealthy,
                                             const client_is_unhealthy_notifier_t& notify_client_as_unhealthy_to_the_server)
             : m_callback_register(callback_register)
-            , m_receive_buffer(make_shared_buffer())
-            , m_alias(fmt::format("base_abstract_connection_unwrapped({})", static_cast<void*>(this)))
+            , m_receive_buffer()
+            , m_receive_flow()
+            , m_alias()
             , m_alias_mutex()
             , m_id(INVALID_CLIENT_ID)
+            , m_sent_notification(HL_NET_DEFAULT_SENT_NOTIFICATION)
+            , m_send_backlog()
             , m_healthy(false)
             , m_running(false)
             , m_notify_server_as_unhealthy(notify_server_as_unhealthy)
             , m_notify_client_as_unhealthy_to_the_server(notify_client_as_unhealthy_to_the_server)
         {
-            HL_NET_LOG_TRACE("Creating base_abstract_connection_unwrapped: {}", get_alias());
+            HL_NET_LOG_TRACE("Creating base_abstract_connection_unwrapped: {}", static_cast<const void*>(this));
         }
 
     public:
         virtual ~base_abstract_connection_unwrapped() override
         {
-            HL_NET_LOG_TRACE("Destroying base_abstract_connection_unwrapped: {}", get_alias());
-            HL_NET_LOG_TRACE("Destroyed base_abstract_connection_unwrapped: {}", get_alias());
+            HL_NET_LOG_TRACE("Destroying base_abstract_connection_unwrapped: {}", static_cast<const void*>(this));
+            HL_NET_LOG_TRACE("Destroyed base_abstract_connection_unwrapped: {}", static_cast<const void*>(this));
         }
     };
 
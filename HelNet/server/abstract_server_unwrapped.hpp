@@ -5,21 +5,110 @@ Copyright: (C) 2024 Mattis DALLEAU
 
 #pragma once
 
+#include <memory>
+#include <thread>
+#include <vector>
+
 #include <boost/asio/io_service.hpp>
+#include <boost/asio/post.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include "HelNet/server/callbacks.hpp"
 #include "HelNet/server/abstract_connection_unwrapped.hpp"
+#include "HelNet/server/connection_table.hpp"
 #include "HelNet/server/utils.hpp"
+#include "HelNet/event_notifier.hpp"
 
 namespace hl
 {
 namespace net
 {
+#ifndef HL_NET_DEFAULT_SERVER_IO_THREADS
+    // Threads running the io_service of a server, 0 means one per hardware thread
+    #define HL_NET_DEFAULT_SERVER_IO_THREADS 1
+#endif
+
+#ifndef HL_NET_DEFAULT_SERVER_IO_SHARDS
+    // io_services of a server, each one run by its own io threads, 0 means one per hardware thread
+    #define HL_NET_DEFAULT_SERVER_IO_SHARDS 1
+#endif
+
     // Server
-    using client_holder_t = std::unordered_map<client_id_t, connection_t>;
-    using client_holder_name_to_id_t = utils::back_and_forth_unordered_map<std::string, client_id_t>;
+    // aggregated result of a broadcast/send_to_many once every send is over
+    struct broadcast_report
+    {
+        size_t targets;     // connections the buffer was meant for
+        size_t rejected;    // unknown ids or sends refused before reaching the socket
+        size_t sent;        // sends completed without error
+        size_t failed;      // sends completed with an error
+        size_t bytes_sent;  // sum of the bytes sent by every completed send
+    };
+
+    using broadcast_completion_t = std::function<void(const broadcast_report&)>;
+
+    namespace internal
+    {
+        // shared by every send of a broadcast, the last one to finish reports
+        class broadcast_state final
+        {
+        private:
+            const broadcast_completion_t m_completion;
+            const size_t m_targets;
+            std::atomic<size_t> m_pending;
+            std::atomic<size_t> m_rejected;
+            std::atomic<size_t> m_sent;
+            std::atomic<size_t> m_failed;
+            std::atomic<size_t> m_bytes_sent;
+
+            void _release()
+            {
+                if (m_pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                {
+                    return;
+                }
+                const broadcast_report report = {
+                    m_targets,
+                    m_rejected.load(std::memory_order_relaxed),
+                    m_sent.load(std::memory_order_relaxed),
+                    m_failed.load(std::memory_order_relaxed),
+                    m_bytes_sent.load(std::memory_order_relaxed)
+                };
+                m_completion(report);
+            }
+
+        public:
+            // one pending reference per target plus one held by the caller until end()
+            broadcast_state(const broadcast_completion_t &completion, const size_t targets)
+                : m_completion(completion)
+                , m_targets(targets)
+                , m_pending(targets + 1)
+                , m_rejected(0)
+                , m_sent(0)
+                , m_failed(0)
+                , m_bytes_sent(0)
+            {}
+
+            void reject()
+            {
+                m_rejected.fetch_add(1, std::memory_order_relaxed);
+                _release();
+            }
+
+            void complete(const boost::system::error_code &ec, const size_t bytes_transferred)
+            {
+                (ec ? m_failed : m_sent).fetch_add(1, std::memory_order_relaxed);
+                m_bytes_sent.fetch_add(bytes_transferred, std::memory_order_relaxed);
+                _release();
+            }
+
+            void end()
+            {
+                _release();
+            }
+        };
+    }
 
 HL_NET_DIAGNOSTIC_PUSH()
 HL_NET_DIAGNOSTIC_NON_VIRTUAL_DESTRUCTOR_IGNORED()
@@ -39,63 +128,77 @@ HL_NET_DIAGNOSTIC_POP()
         std::atomic_bool m_running;
         std::atomic_bool m_healthy;
 
-        boost::asio::io_service m_io_service;
-        std::thread m_io_service_thread;
+        // one io_service per shard, a socket is only used by the threads of its shard
+        std::vector<std::unique_ptr<boost::asio::io_service>> m_io_services;
+        std::vector<std::unique_ptr<boost::asio::io_service::work>> m_io_services_work;
+        std::vector<std::thread> m_io_service_threads;
+        std::atomic<size_t> m_io_threads;
+        std::atomic<size_t> m_io_shards;
+        size_t m_active_io_shards;
 
-        atomic_client_id m_last_id;
-        client_holder_t m_connections;
-        client_holder_name_to_id_t m_connections_name_to_id;
+        // read without lock by the send paths
+        connection_table m_connections;
 
+        // reported by the connections, reaped in batches by a task posted on the io_service of shard 0
         unhealthy_connexions_t m_unhealthy_connections;
-        std::thread m_unhealthy_connections_thread;
-        std::condition_variable m_unhealthy_connections_cv;
+        bool m_unhealthy_connections_reap_posted;
         mutable std::mutex m_unhealthy_connections_mutex;
-        mutable std::mutex m_connections_mutex;
+
+        receive_mode m_receive_mode;
+        buffer_provider_t m_receive_buffer_provider;
+        std::atomic<size_t> m_receive_backlog_high;
+        std::atomic<size_t> m_receive_backlog_low;
+        std::atomic<sent_notification> m_sent_notification;
+        std::atomic<size_t> m_send_high_watermark;
+        std::atomic<size_t> m_send_low_watermark;
+
+        event_notifier m_events;
 
     protected:
+        // start/stop and (re)arming of accepts/receives, the send paths take no lock
         std::mutex m_mutex_api_control_flow;
     
     private:
-        void basic_io_service_coroutine()
+        void basic_io_service_coroutine(const size_t shard)
         {
-            HL_NET_LOG_TRACE("Starting io_service coroutine for: {}", get_alias());
-            while (healthy())
-            {
-                m_io_service.run();
-                HL_NET_LOG_TRACE("Restarting io_service coroutine for: {}", get_alias());
-                m_io_service.reset();
-            }
-            HL_NET_LOG_TRACE("Stopping io_service coroutine for: {}", get_alias());
+            HL_NET_LOG_TRACE("Starting io_service coroutine {} for: {}", shard, get_alias());
+            // m_io_services_work keeps run() from returning until _unsafe_stop(),
+            // restarting it here would race with the other io threads
+            m_io_services[shard]->run();
+            HL_NET_LOG_TRACE("Stopping io_service coroutine {} for: {}", shard, get_alias());
         }
 
-        void unhealthy_thread_check_coroutine()
+        static size_t _hardware_threads()
         {
-            HL_NET_LOG_TRACE("Starting unhealthy connections thread for server: {}", get_alias());
-            while (true)
-            {
-                std::unique_lock<std::mutex> lock_waiter(m_unhealthy_connections_mutex);
+            const size_t hardware_threads = std::thread::hardware_concurrency();
+            return hardware_threads ? hardware_threads : 1;
+        }
 
-                // wait that unealthy connections are available or that the server is not healthy
-                m_unhealthy_connections_cv.wait(lock_waiter, [this]() -> bool {
-                    return !m_unhealthy_connections.empty() || !this->healthy();
-                });
+        // removes every connection reported since the last pass and emits on_disconnection for each of them
+        void _reap_unhealthy_connections()
+        {
+            unhealthy_connexions_t unhealthy_connections;
+            {
+                std::lock_guard<std::mutex> lock(m_unhealthy_connections_mutex);
+                unhealthy_connections.swap(m_unhealthy_connections);
+                m_unhealthy_connections_reap_posted = false;
+            }
+            if (unhealthy_connections.empty() || !healthy())
+            {
+                return;
+            }
 
-                if (!this->healthy()) {
-                    break;
-                }
-                client_id_t endpoint_id;
+            HL_NET_LOG_DEBUG("Reaping {} unhealthy connections of server: {}", unhealthy_connections.size(), get_alias());
+            for (const client_id_t &client_id : unhealthy_connections)
+            {
+                // a connection can report itself twice (failed receive and send)
+                const connection_t connection = m_connections.erase(client_id);
+                if (connection)
                 {
-                    std::lock_guard<std::mutex> lock_connections(m_connections_mutex);
-                    while (!m_unhealthy_connections.empty()) {
-                        endpoint_id = m_unhealthy_connections.front();
-                        m_unhealthy_connections.pop();
-                        if (this->healthy()) {
-                            _unset_connection<false>(endpoint_id);
-                        }
-                    }
+                    _on_unset_connection(connection);
+                    callbacks_register().on_disconnection(client_id);
                 }
             }
-            HL_NET_LOG_TRACE("Stopping unhealthy connections thread for server (unhealthy or disconnected): {}", get_alias());
         }
 
     protected:
@@ -104,18 +207,32 @@ HL_NET_DIAGNOSTIC_POP()
             HL_NET_LOG_TRACE("Starting server pool: {}", get_alias());
 
             callbacks_register().unsafe_start_pool();
+            warm_up_shared_buffers(HL_NET_BUFFER_POOL_WARM_UP);
 
-            m_last_id = BASE_CLIENT_ID;
+            {
+                // the ids of the previous run are reused by the new connections
+                std::lock_guard<std::mutex> lock(m_unhealthy_connections_mutex);
+                m_unhealthy_connections.clear();
+            }
 
             set_run_status(true);
             set_health_status(true);
 
-            m_io_service_thread = std::thread(
-                std::bind(&this_type_t::basic_io_service_coroutine, this)
-            );
-            m_unhealthy_connections_thread = std::thread(
-                std::bind(&this_type_t::unhealthy_thread_check_coroutine, this)
-            );
+            const size_t io_shards = _unsafe_prepare_io_shards();
+            const size_t io_threads = get_io_threads();
+            m_io_service_threads.reserve(io_shards * io_threads);
+            for (size_t shard = 0; shard < io_shards; ++shard)
+            {
+                m_io_services[shard]->restart();
+                m_io_services_work.emplace_back(new boost::asio::io_service::work(*m_io_services[shard]));
+                for (size_t i = 0; i < io_threads; ++i)
+                {
+                    m_io_service_threads.emplace_back(
+                        std::bind(&this_type_t::basic_io_service_coroutine, this, shard)
+                    );
+                }
+            }
+            HL_NET_LOG_DEBUG("Started {} io shards of {} threads for: {}", io_shards, io_threads, get_alias());
 
             HL_NET_LOG_TRACE("Started server pool: {}", get_alias());
         }
@@ -126,135 +243,216 @@ HL_NET_DIAGNOSTIC_POP()
 
             set_run_status(false);
             set_health_status(false);
-            m_io_service.stop();
-            m_io_service_thread.join();
-            m_unhealthy_connections_cv.notify_one();
-            m_unhealthy_connections_thread.join();
-            callbacks_register().on_stop_success();
-            callbacks_register().unsafe_stop_pool();
+            m_io_services_work.clear();
+            for (size_t shard = 0; shard < m_active_io_shards; ++shard)
+            {
+                m_io_services[shard]->stop();
+            }
+            for (std::thread &io_thread : m_io_service_threads)
             {
-                std::lock_guard<std::mutex> lock(m_connections_mutex);
-                m_connections.clear();
+                io_thread.join();
             }
+            m_io_service_threads.clear();
+            callbacks_register().on_stop_success();
+            callbacks_register().unsafe_stop_pool();
+            // the ids restart from BASE_CLIENT_ID on the next start
+            m_connections.clear();
             HL_NET_LOG_TRACE("Stopped server pool: {}", get_alias());
         }
 
-        template<bool LockConnectionMutex>
-        connection_t _get_connection(const client_id_t& client_id)
-        {
-            _HL_INTERNAL_LOCK_GUARD_WHEN_TRUE(LockConnectionMutex, lock_conn, m_connections_mutex, {
-                if (client_id == INVALID_CLIENT_ID) return nullptr;
-                auto it = m_connections.find(client_id);
-                return it == m_connections.end() ? nullptr : it->second;
-            });
-        }
-
-        template<bool LockConnectionMutex>
-        const connection_t _get_connection(const client_id_t& client_id) const
+        connection_t _get_connection(const client_id_t& client_id) const
         {
-            _HL_INTERNAL_LOCK_GUARD_WHEN_TRUE(LockConnectionMutex, lock_conn, m_connections_mutex, {
-                if (client_id == INVALID_CLIENT_ID) return nullptr;
-                auto it = m_connections.find(client_id);
-                return it == m_connections.end() ? nullptr : it->second;
-            });
+            return m_connections.find(client_id);
         }
 
-        template<bool LockConnectionMutex>
         bool _has_connection(const client_id_t& client_id) const
         {
-            _HL_INTERNAL_LOCK_GUARD_WHEN_TRUE(LockConnectionMutex, lock_conn, m_connections_mutex, {
-                return m_connections.find(client_id) != m_connections.end();
-            });
+            return m_connections.contains(client_id);
         }
 
-        template<bool LockConnectionMutex>
-        connection_t _get_connection(const std::string &endpoint_id)
+        // id of the connection whose endpoint is `endpoint_id`, INVALID_CLIENT_ID when unknown
+        virtual client_id_t _find_id(const std::string &endpoint_id) const
         {
-            _HL_INTERNAL_LOCK_GUARD_WHEN_TRUE(LockConnectionMutex, lock_conn, m_connections_mutex, {
-                client_holder_name_to_id_t::forward_iterator it = m_connections_name_to_id.find_forward(endpoint_id);
-                return it == m_connections_name_to_id.end_forward() ? nullptr : _get_connection<false>(it->second);
-            });
+            return m_connections.find_id(endpoint_id);
         }
 
-        template<bool LockConnectionMutex>
-        const connection_t _get_connection(const std::string &endpoint_id) const
+        connection_t _get_connection(const std::string &endpoint_id) const
         {
-            _HL_INTERNAL_LOCK_GUARD_WHEN_TRUE(LockConnectionMutex, lock_conn, m_connections_mutex, {
-                client_holder_name_to_id_t::const_forward_iterator it = m_connections_name_to_id.find_forward(endpoint_id);
-                return it == m_connections_name_to_id.end_forward() ? nullptr : _get_connection<false>(it->second);
-            });
+            return m_connections.find(_find_id(endpoint_id));
         }
 
-        template<bool LockConnectionMutex>
         bool _has_connection(const std::string &endpoint_id) const
         {
-            _HL_INTERNAL_LOCK_GUARD_WHEN_TRUE(LockConnectionMutex, lock_conn, m_connections_mutex, {
-                return m_connections_name_to_id.find_forward(endpoint_id) != m_connections_name_to_id.end_forward();
-            });
+            return _find_id(endpoint_id) != INVALID_CLIENT_ID;
         }
 
-        template<bool LockConnectionMutex>
-        void _set_connection(const connection_t& connection,
+        // false when the connections table is full
+        bool _set_connection(const connection_t& connection,
                              const std::string& name)
         {
-            _HL_INTERNAL_LOCK_GUARD_WHEN_TRUE(LockConnectionMutex, lock, m_connections_mutex, {
-                do {
-                    for (; m_connections.find(m_last_id) != m_connections.end(); ++m_last_id);
-                } while (m_last_id == INVALID_CLIENT_ID); // find a valid id in case of overflow
-                connection->set_alias(name);
-                connection->set_id(m_last_id++);
-                m_connections.emplace(connection->get_id(), connection);
-                m_connections_name_to_id.insert(name, connection->get_id());
-            });
+            connection->set_alias(name);
+            if (m_connections.insert(connection, name) == INVALID_CLIENT_ID)
+            {
+                HL_NET_LOG_ERROR("Cannot add connection: {} to the full connections table of server: {}", name, get_alias());
+                return false;
+            }
+            return true;
+        }
+
+        // the connection keeps its own alias and is not indexed by name, see _find_id()
+        bool _set_connection(const connection_t& connection)
+        {
+            if (m_connections.insert(connection) == INVALID_CLIENT_ID)
+            {
+                HL_NET_LOG_ERROR("Cannot add connection: {} to the full connections table of server: {}", connection->get_alias(), get_alias());
+                return false;
+            }
+            return true;
         }
 
-        template<bool LockConnectionMutex>
         bool _unset_connection(const client_id_t& client_id)
         {
-            _HL_INTERNAL_LOCK_GUARD_WHEN_TRUE(LockConnectionMutex, lock, m_connections_mutex, {
-                HL_NET_LOG_ERROR("Unsetting connection: {} from server: {}", client_id, get_alias());
-                client_holder_t::iterator it = m_connections.find(client_id);
-                if (it == m_connections.end())
-                {
-                    HL_NET_LOG_ERROR("Cannot unset a non-existing connection: {} from server: {}", client_id, get_alias());
-                    callbacks_register().on_disconnection_error(boost::asio::error::not_found);
-                    return false;
-                }
-                m_connections.erase(it);
-                m_connections_name_to_id.erase(client_id);
-                return true;
-            });
+            HL_NET_LOG_DEBUG("Unsetting connection: {} from server: {}", client_id, get_alias());
+            const connection_t connection = m_connections.erase(client_id);
+            if (!connection)
+            {
+                HL_NET_LOG_ERROR("Cannot unset a non-existing connection: {} from server: {}", client_id, get_alias());
+                callbacks_register().on_disconnection_error(boost::asio::error::not_found);
+                return false;
+            }
+            _on_unset_connection(connection);
+            return true;
         }
 
-        template<bool LockConnectionMutex>
         bool _unset_connection(const std::string &endpoint_id)
         {
-            _HL_INTERNAL_LOCK_GUARD_WHEN_TRUE(LockConnectionMutex, lock, m_connections_mutex, {
-                client_holder_name_to_id_t::forward_iterator it = m_connections_name_to_id.find_forward(endpoint_id);
-                if (it == m_connections_name_to_id.end_forward())
+            const client_id_t client_id = _find_id(endpoint_id);
+            if (client_id == INVALID_CLIENT_ID)
+            {
+                HL_NET_LOG_ERROR("Cannot unset a non-existing connection: {} from server: {}", endpoint_id, get_alias());
+                callbacks_register().on_disconnection_error(boost::asio::error::not_found);
+                return false;
+            }
+            return _unset_connection(client_id);
+        }
+
+        // sends through the connection without taking a reference on it
+        template<typename Send>
+        send_result _send_to(const client_id_t& client_id, const Send &send_function)
+        {
+            send_result sent;
+            const bool found = m_connections.apply(client_id, [&send_function, &sent](base_abstract_connection_unwrapped &connection) -> bool {
+                sent = send_function(connection);
+                return true;
+            }, false);
+            if (!found)
+            {
+                HL_NET_LOG_ERROR("Cannot send data to a non-existing connection: {} from server: {}", client_id, get_alias());
+                connection_t conn_null = nullptr;
+                callbacks_register().on_send_error(conn_null, boost::asio::error::not_connected, 0);
+            }
+            return sent;
+        }
+
+        // called when a connection leaves the table (not on stop), may run concurrently with the send paths
+        virtual void _on_unset_connection(const connection_t &)
+        {
+        }
+
+        // sends the same buffer to every connection of the snapshot, returns the number of sends started
+        size_t _send_to_snapshot(const std::vector<connection_t> &connections,
+                                 const size_t missing,
+                                 const shared_buffer_t &buffer,
+                                 const size_t &size,
+                                 const broadcast_completion_t &completion)
+        {
+            if (!buffer || !size || size > buffer->size())
+            {
+                HL_NET_LOG_ERROR("Cannot broadcast {} bytes from an invalid buffer from server: {}", size, get_alias());
+                connection_t null_connection = nullptr;
+                callbacks_register().on_send_error(null_connection, boost::system::error_code(boost::asio::error::invalid_argument), 0);
+                if (completion)
                 {
-                    HL_NET_LOG_ERROR("Cannot unset a non-existing connection: {} from server: {}", endpoint_id, get_alias());
-                    callbacks_register().on_disconnection_error(boost::asio::error::not_found);
-                    return false;
+                    const broadcast_report report = { connections.size() + missing, connections.size() + missing, 0, 0, 0 };
+                    completion(report);
                 }
-                m_connections.erase(it->second);
-                m_connections_name_to_id.erase(it);
-                return true;
-            });
+                return 0;
+            }
+
+            size_t started = 0;
+
+            if (!completion)
+            {
+                for (const connection_t &connection : connections)
+                {
+                    started += connection->send(buffer, size) ? 1 : 0;
+                }
+                return started;
+            }
+
+            const boost::shared_ptr<internal::broadcast_state> state =
+                boost::make_shared<internal::broadcast_state>(completion, connections.size() + missing);
+            const send_completion_t on_send_over = [state](const boost::system::error_code &ec, const size_t bytes_transferred) -> void {
+                state->complete(ec, bytes_transferred);
+            };
+
+            for (size_t i = 0; i < missing; ++i)
+            {
+                state->reject();
+            }
+            for (const connection_t &connection : connections)
+            {
+                if (connection->send(buffer, size, on_send_over))
+                {
+                    ++started;
+                }
+                else
+                {
+                    state->reject();
+                }
+            }
+            state->end();
+            return started;
+        }
+
+        // creates the io_services of the shards used by the next start, returns their count
+        size_t _unsafe_prepare_io_shards()
+        {
+            m_active_io_shards = get_io_shards();
+            while (m_io_services.size() < m_active_io_shards)
+            {
+                m_io_services.emplace_back(new boost::asio::io_service);
+            }
+            return m_active_io_shards;
+        }
+
+        size_t _io_shards() const
+        {
+            return m_active_io_shards;
+        }
+
+        boost::asio::io_service& _io_service(const size_t shard = 0)
+        {
+            return *m_io_services[shard];
         }
 
-        // utility function to lock the connections mutex and apply a function
-        // required when get&set connections are done manually
-        template<typename ReturnType>
-        ReturnType _lock_connection_and_apply(const std::function<ReturnType()> &apply)
+        void _setup_receive(const connection_t& connection) const
         {
-            std::lock_guard<std::mutex> lock(m_connections_mutex);
-            return apply();
+            connection->set_receive_mode(m_receive_mode);
+            connection->set_receive_buffer_provider(m_receive_buffer_provider);
+            connection->set_receive_backlog(m_receive_backlog_high, m_receive_backlog_low);
         }
 
-        boost::asio::io_service& _io_service()
+        void _setup_send(const connection_t& connection) const
         {
-            return m_io_service;
+            connection->set_sent_notification(m_sent_notification);
+            connection->set_send_watermarks(m_send_high_watermark, m_send_low_watermark);
+        }
+
+        void _setup_receive(receive_buffer_holder& holder) const
+        {
+            holder.set_mode(m_receive_mode);
+            holder.set_provider(m_receive_buffer_provider);
         }
 
     public:
@@ -262,8 +460,13 @@ HL_NET_DIAGNOSTIC_POP()
         {
             return [this](const client_id_t& client_id) -> void {
                 std::lock_guard<std::mutex> lock(m_unhealthy_connections_mutex);
-                m_unhealthy_connections.push(client_id);
-                m_unhealthy_connections_cv.notify_one();
+                m_unhealthy_connections.push_back(client_id);
+                // the reports arriving before the pass runs are reaped with this one
+                if (!m_unhealthy_connections_reap_posted)
+                {
+                    m_unhealthy_connections_reap_posted = true;
+                    boost::asio::post(*m_io_services[0], std::bind(&this_type_t::_reap_unhealthy_connections, this));
+                }
             };
         }
 
@@ -281,6 +484,7 @@ HL_NET_DIAGNOSTIC_POP()
         {
             HL_NET_LOG_WARN("Server: {} is now {}", get_alias(), status ? "running" : "stopped");
             m_running = status;
+            m_events.notify();
         }
 
         bool healthy() const
@@ -292,6 +496,7 @@ HL_NET_DIAGNOSTIC_POP()
         {
             HL_NET_LOG_WARN("Server: {} health is now {}", get_alias(), status ? "healthy" : "unhealthy");
             m_healthy = status;
+            m_events.notify();
         }
 
         // alias to set_health_status(false) to stop the server
@@ -305,6 +510,12 @@ HL_NET_DIAGNOSTIC_POP()
             return m_callback_register;
         }
 
+        // notified on every run or health status change
+        event_notifier& events()
+        {
+            return m_events;
+        }
+
         const std::string get_alias() const
         {
             std::lock_guard<std::mutex> lock(m_alias_mutex);
@@ -318,9 +529,99 @@ HL_NET_DIAGNOSTIC_POP()
             m_alias = alias;
         }
 
+        // null once the server is being destroyed (callbacks raised by the stop of the destructor)
         server_t as_sharable()
         {
-            return shared_from_this();
+            return weak_from_this().lock();
+        }
+
+        // number of threads running the io_service of each shard (handlers of different connections run concurrently),
+        // 0 means one per hardware thread, applied on the next start()
+        void set_io_threads(const size_t count)
+        {
+            m_io_threads = count;
+        }
+
+        size_t get_io_threads() const
+        {
+            const size_t count = m_io_threads;
+            return count ? count : _hardware_threads();
+        }
+
+        // number of io_services each run by get_io_threads() threads, a connection stays on the shard it was accepted on,
+        // tcp servers listen with one SO_REUSEPORT acceptor per shard, 0 means one per hardware thread, applied on the next start()
+        void set_io_shards(const size_t count)
+        {
+            m_io_shards = count;
+        }
+
+        size_t get_io_shards() const
+        {
+            const size_t count = m_io_shards;
+            return count ? count : _hardware_threads();
+        }
+
+        // applied to the connections accepted after the call, must be set before start() for udp
+        void set_receive_mode(const receive_mode mode)
+        {
+            m_receive_mode = mode;
+        }
+
+        receive_mode get_receive_mode() const
+        {
+            return m_receive_mode;
+        }
+
+        // applied to the connections accepted after the call, must be set before start() for udp
+        void set_receive_buffer_provider(const buffer_provider_t &provider)
+        {
+            m_receive_buffer_provider = provider;
+        }
+
+        // applied to the connections accepted after the call: a tcp connection stops receiving once `high` of its
+        // async callbacks wait to run and receives again when they fall to `low` (0 disables it)
+        void set_receive_backlog(const size_t high, const size_t low)
+        {
+            m_receive_backlog_high = high;
+            m_receive_backlog_low = low;
+        }
+
+        size_t get_receive_backlog_high() const
+        {
+            return m_receive_backlog_high;
+        }
+
+        size_t get_receive_backlog_low() const
+        {
+            return m_receive_backlog_low;
+        }
+
+        // applied to the connections accepted after the call, only used by tcp
+        void set_sent_notification(const sent_notification notification)
+        {
+            m_sent_notification = notification;
+        }
+
+        sent_notification get_sent_notification() const
+        {
+            return m_sent_notification;
+        }
+
+        // watermarks of the bytes queued behind each connection accepted from now on (see send_result and on_writable)
+        void set_send_watermarks(const size_t high, const size_t low)
+        {
+            m_send_high_watermark = high;
+            m_send_low_watermark = std::min(low, high);
+        }
+
+        size_t get_send_high_watermark() const
+        {
+            return m_send_high_watermark;
+        }
+
+        size_t get_send_low_watermark() const
+        {
+            return m_send_low_watermark;
         }
 
     public:
@@ -328,46 +629,117 @@ HL_NET_DIAGNOSTIC_POP()
         virtual bool stop() = 0;
 
     public:
-        bool send(const client_id_t& client_id, const shared_buffer_t &buffer, const size_t &size)
+        send_result send(const client_id_t& client_id, const shared_buffer_t &buffer, const size_t &size)
         {
-            std::lock_guard<std::mutex> lock(m_mutex_api_control_flow);
             HL_NET_LOG_DEBUG("Sending {} bytes to client: {} from server: {}", size, client_id, get_alias());
 
-            connection_t connection = _get_connection<true>(client_id);
+            return _send_to(client_id, [&buffer, &size](base_abstract_connection_unwrapped &connection) -> send_result {
+                return connection.send(buffer, size);
+            });
+        }
+
+        send_result send(const std::string &endpoint_id, const shared_buffer_t &buffer, const size_t &size)
+        {
+            HL_NET_LOG_DEBUG("Sending {} bytes to client: {} from server: {}", size, endpoint_id, get_alias());
+
+            connection_t connection = _get_connection(endpoint_id);
             if (!connection)
             {
-                HL_NET_LOG_ERROR("Cannot send data to a non-existing connection: {} from server: {}", client_id, get_alias());
-                connection_t conn_null = nullptr;
-                callbacks_register().on_send_error(conn_null, boost::asio::error::not_connected, 0);
+                HL_NET_LOG_ERROR("Cannot send data to a non-existing connection: {} from server: {}", endpoint_id, get_alias());
+                connection_t null_connection = nullptr;
+                callbacks_register().on_send_error(null_connection, boost::system::error_code(boost::asio::error::not_found), size);
                 return false;
             }
             return connection->send(buffer, size);
         }
 
-        bool send(const std::string &endpoint_id, const shared_buffer_t &buffer, const size_t &size)
+        send_result send(const client_id_t& client_id, const shared_buffer_sequence_t &buffers)
         {
-            std::lock_guard<std::mutex> lock(m_mutex_api_control_flow);
-            HL_NET_LOG_DEBUG("Sending {} bytes to client: {} from server: {}", size, endpoint_id, get_alias());
+            HL_NET_LOG_DEBUG("Sending {} buffers to client: {} from server: {}", buffers.size(), client_id, get_alias());
+
+            return _send_to(client_id, [&buffers](base_abstract_connection_unwrapped &connection) -> send_result {
+                return connection.send(buffers);
+            });
+        }
+
+        send_result send(const std::string &endpoint_id, const shared_buffer_sequence_t &buffers)
+        {
+            HL_NET_LOG_DEBUG("Sending {} buffers to client: {} from server: {}", buffers.size(), endpoint_id, get_alias());
 
-            connection_t connection = _get_connection<true>(endpoint_id);
+            connection_t connection = _get_connection(endpoint_id);
             if (!connection)
             {
                 HL_NET_LOG_ERROR("Cannot send data to a non-existing connection: {} from server: {}", endpoint_id, get_alias());
                 connection_t null_connection = nullptr;
-                callbacks_register().on_send_error(null_connection, boost::system::error_code(boost::asio::error::not_found), size);
+                callbacks_register().on_send_error(null_connection, boost::system::error_code(boost::asio::error::not_found), 0);
                 return false;
             }
-            return connection->send(buffer, size);
+            return connection->send(buffers);
+        }
+
+        // sends the same buffer to every connected client with a single lookup of the connection table
+        // on_sent/on_send_error are still called for each connection, completion (optional) once every send is over
+        // the buffer is shared by every send and must not be modified until then
+        // returns the number of sends started
+        size_t broadcast(const shared_buffer_t &buffer, const size_t &size, const broadcast_completion_t &completion = nullptr)
+        {
+            const std::vector<connection_t> connections = m_connections.snapshot();
+
+            HL_NET_LOG_DEBUG("Broadcasting {} bytes to {} clients from server: {}", size, connections.size(), get_alias());
+            return _send_to_snapshot(connections, 0, buffer, size, completion);
+        }
+
+        // same as broadcast() for the given client ids, unknown ids are counted as rejected
+        template<typename ClientIdRange>
+        size_t send_to_many(const ClientIdRange &client_ids, const shared_buffer_t &buffer, const size_t &size, const broadcast_completion_t &completion = nullptr)
+        {
+            std::vector<connection_t> connections;
+            size_t missing = 0;
+            for (const client_id_t &client_id : client_ids)
+            {
+                connection_t connection = _get_connection(client_id);
+                if (connection)
+                {
+                    connections.push_back(connection);
+                }
+                else
+                {
+                    ++missing;
+                }
+            }
+
+            if (missing)
+            {
+                HL_NET_LOG_WARN("Cannot send data to {} non-existing connections from server: {}", missing, get_alias());
+            }
+            HL_NET_LOG_DEBUG("Sending {} bytes to {} clients from server: {}", size, connections.size(), get_alias());
+            return _send_to_snapshot(connections, missing, buffer, size, completion);
+        }
+
+        size_t send_to_many(const std::initializer_list<client_id_t> &client_ids, const shared_buffer_t &buffer, const size_t &size, const broadcast_completion_t &completion = nullptr)
+        {
+            return send_to_many<std::initializer_list<client_id_t>>(client_ids, buffer, size, completion);
+        }
+
+        // handle to keep instead of the connection_t, it must not outlive the server
+        connection_handle get_handle(const client_id_t& client_id) const
+        {
+            return connection_handle(m_connections, client_id);
+        }
+
+        connection_handle get_handle(const connection_t& connection) const
+        {
+            return connection_handle(m_connections, connection ? connection->get_id() : INVALID_CLIENT_ID);
         }
 
         bool disconnect(const client_id_t& client_id)
         {
-            return _unset_connection<true>(client_id);
+            return _unset_connection(client_id);
         }
 
         bool disconnect(const std::string &endpoint_id)
         {
-            return _unset_connection<true>(endpoint_id);
+            return _unset_connection(endpoint_id);
         }
 
     protected:
@@ -377,19 +749,29 @@ HL_NET_DIAGNOSTIC_POP()
             , m_alias_mutex()
             , m_running(false)
             , m_healthy(false)
-            , m_io_service()
-            , m_io_service_thread()
-            , m_last_id()
+            , m_io_services()
+            , m_io_services_work()
+            , m_io_service_threads()
+            , m_io_threads(HL_NET_DEFAULT_SERVER_IO_THREADS)
+            , m_io_shards(HL_NET_DEFAULT_SERVER_IO_SHARDS)
+            , m_active_io_shards(1)
             , m_connections()
-            , m_connections_name_to_id()
             , m_unhealthy_connections()
-            , m_unhealthy_connections_thread()
-            , m_unhealthy_connections_cv()
+            , m_unhealthy_connections_reap_posted(false)
             , m_unhealthy_connections_mutex()
-            , m_connections_mutex()
+            , m_receive_mode(HL_NET_DEFAULT_RECEIVE_MODE)
+            , m_receive_buffer_provider(nullptr)
+            , m_receive_backlog_high(HL_NET_DEFAULT_RECEIVE_BACKLOG_HIGH)
+            , m_receive_backlog_low(HL_NET_DEFAULT_RECEIVE_BACKLOG_LOW)
+            , m_sent_notification(HL_NET_DEFAULT_SENT_NOTIFICATION)
+            , m_send_high_watermark(HL_NET_DEFAULT_SEND_HIGH_WATERMARK)
+            , m_send_low_watermark(HL_NET_DEFAULT_SEND_LOW_WATERMARK)
+            , m_events()
             , m_mutex_api_control_flow()
         {
             HL_NET_LOG_TRACE("Creating base_abstract_server_unwrapped: {}", get_alias());
+            // shard 0 exists from the start, the sockets of the derived servers are built on it
+            m_io_services.emplace_back(new boost::asio::io_service);
         }
 
     public:
@@ -399,24 +781,24 @@ HL_NET_DIAGNOSTIC_POP()
         }
 
     public:
-        bool send(const client_id_t& client_id, const shared_buffer_t &buffer)
+        send_result send(const client_id_t& client_id, const shared_buffer_t &buffer)
         {
             return send(client_id, buffer, buffer->size());
         }
 
-        bool send_bytes(const client_id_t& client_id, const byte *data, const size_t &size)
+        send_result send_bytes(const client_id_t& client_id, const byte *data, const size_t &size)
         {
             shared_buffer_t buffer = make_shared_buffer(data, size);
             return send(client_id, buffer, size);
         }
 
         template<typename T>
-        inline bool send_bytes(const client_id_t& client_id, const std::vector<T> &data)
+        inline send_result send_bytes(const client_id_t& client_id, const std::vector<T> &data)
         {
             return send_bytes(client_id, reinterpret_cast<const byte *>(data.data()), data.size() * sizeof(T));
         }
 
-        inline bool send_string(const client_id_t& client_id, const std::string &str)
+        inline send_result send_string(const client_id_t& client_id, const std::string &str)
         {
             return send_bytes(client_id, reinterpret_cast<const byte *>(str.data()), str.size());
         }
@@ -8,8 +8,11 @@ Copyright: (C) 2024 Mattis DALLEAU
 #include "HelNet/base.hpp"
 #include "HelNet/logger.hpp"
 #include "HelNet/defines.hpp"
+#include "HelNet/callback_pool.hpp"
+#include "HelNet/callback_handlers.hpp"
+#include "HelNet/server/udp/peer_table.hpp"
 
-#include <hl/silva/collections/threads/basic_pool_async.hpp>
+#include <boost/asio/ip/udp.hpp>
 #include <boost/system/error_code.hpp>
 
 namespace hl
@@ -35,10 +38,13 @@ namespace net
 
     using server_on_sent_callback                   = std::function<void(server_t server, connection_t client, const size_t sent_bytes)>;
     using server_on_send_error_callback             = std::function<void(server_t server, connection_t client, const boost::system::error_code ec, const size_t sent_bytes)>;
+    using server_on_writable_callback               = std::function<void(server_t server, connection_t client)>;
 
     using server_on_receive_callback                = std::function<void(server_t server, connection_t client, shared_buffer_t buffer_copy, const size_t recv_bytes)>;
     using server_on_receive_error_callback          = std::function<void(server_t server, connection_t client, shared_buffer_t buffer_copy, const boost::system::error_code ec, const size_t recv_bytes)>;
 
+    using server_on_datagram_callback               = std::function<void(server_t server, const boost::asio::ip::udp::endpoint &sender, shared_buffer_t buffer_copy, const size_t recv_bytes)>;
+
     #define HL_NET_SERVER_ON_START(SERVER) [](server_t SERVER)
     #define HL_NET_SERVER_ON_START_CAPTURE(SERVER, ...) [__VA_ARGS__](server_t SERVER)
     #define HL_NET_SERVER_ON_STOP() []()
@@ -57,10 +63,14 @@ namespace net
     #define HL_NET_SERVER_ON_SENT_CAPTURE(SERVER, CLIENT, SENT_BYTES, ...) [__VA_ARGS__](server_t SERVER, connection_t CLIENT, const size_t SENT_BYTES)
     #define HL_NET_SERVER_ON_SEND_ERROR(SERVER, CLIENT, EC, SENT_BYTES) [](server_t SERVER, connection_t CLIENT, const boost::system::error_code &EC, const size_t SENT_BYTES)
     #define HL_NET_SERVER_ON_SEND_ERROR_CAPTURE(SERVER, CLIENT, EC, SENT_BYTES, ...) [__VA_ARGS__](server_t SERVER, connection_t CLIENT, const boost::system::error_code &EC, const size_t SENT_BYTES)
+    #define HL_NET_SERVER_ON_WRITABLE(SERVER, CLIENT) [](server_t SERVER, connection_t CLIENT)
+    #define HL_NET_SERVER_ON_WRITABLE_CAPTURE(SERVER, CLIENT, ...) [__VA_ARGS__](server_t SERVER, connection_t CLIENT)
     #define HL_NET_SERVER_ON_RECEIVE(SERVER, CLIENT, BUFFER_COPY, RECV_BYTES) [](server_t SERVER, connection_t CLIENT, shared_buffer_t BUFFER_COPY, const size_t RECV_BYTES)
     #define HL_NET_SERVER_ON_RECEIVE_CAPTURE(SERVER, CLIENT, BUFFER_COPY, RECV_BYTES, ...) [__VA_ARGS__](server_t SERVER, connection_t CLIENT, shared_buffer_t BUFFER_COPY, const size_t RECV_BYTES)
     #define HL_NET_SERVER_ON_RECEIVE_ERROR(SERVER, CLIENT, BUFFER_COPY, EC, RECV_BYTES) [](server_t SERVER, connection_t CLIENT, shared_buffer_t BUFFER_COPY, const boost::system::error_code &EC, const size_t RECV_BYTES)
     #define HL_NET_SERVER_ON_RECEIVE_ERROR_CAPTURE(SERVER, CLIENT, BUFFER_COPY, EC, RECV_BYTES, ...) [__VA_ARGS__](server_t SERVER, connection_t CLIENT, shared_buffer_t BUFFER_COPY, const boost::system::error_code &EC, const size_t RECV_BYTES)
+    #define HL_NET_SERVER_ON_DATAGRAM(SERVER, SENDER, BUFFER_COPY, RECV_BYTES) [](server_t SERVER, const boost::asio::ip::udp::endpoint &SENDER, shared_buffer_t BUFFER_COPY, const size_t RECV_BYTES)
+    #define HL_NET_SERVER_ON_DATAGRAM_CAPTURE(SERVER, SENDER, BUFFER_COPY, RECV_BYTES, ...) [__VA_ARGS__](server_t SERVER, const boost::asio::ip::udp::endpoint &SENDER, shared_buffer_t BUFFER_COPY, const size_t RECV_BYTES)
 
     struct server_callbacks final {
         server_on_start_success_callback    on_start_success_callback = nullptr;
@@ -90,12 +100,19 @@ namespace net
         server_on_send_error_callback       on_send_error_callback = nullptr;
         bool                                on_send_error_is_async = false;
 
+        server_on_writable_callback         on_writable_callback = nullptr;
+        bool                                on_writable_is_async = false;
+
         server_on_receive_callback          on_receive_callback = nullptr;
         bool                                on_receive_is_async = false;
 
         server_on_receive_error_callback    on_receive_error_callback = nullptr;
         bool                                on_receive_error_is_async = false;
 
+        // udp servers in stateless mode only, in place of on_connection and on_receive
+        server_on_datagram_callback         on_datagram_callback = nullptr;
+        bool                                on_datagram_is_async = false;
+
         server_callbacks() = default;
         ~server_callbacks() = default;
     };
@@ -103,13 +120,60 @@ namespace net
     class server_callback_register final : public hl::silva::collections::meta::NonCopyMoveable
     {
     private:
-        hl::silva::collections::threads::basic_pool_async m_pool;
+        callback_pool m_pool;
         
     private:
         callback_layer_register_t<server_callbacks> m_callbacks;
         mutable std::mutex m_mutex;
         std::function<server_t(void)> m_get_sharable;
 
+        // the async callbacks of a connection are run in order, the ones without connection have no order to keep
+        // and are spread over the pool
+        template<typename Connection>
+        static callback_pool::key_t _connection_key(const boost::shared_ptr<Connection> &connection)
+        {
+            return connection ? connection->get_id() : callback_pool::NO_KEY;
+        }
+
+        template<typename ...Args>
+        static callback_pool::key_t _async_key(const Args&...)
+        {
+            return callback_pool::NO_KEY;
+        }
+
+        template<typename ...Args>
+        static callback_pool::key_t _async_key(const connection_t &connection, const Args&...)
+        {
+            return _connection_key(connection);
+        }
+
+        // on_disconnection only has the id left, it runs after the callbacks of the connection still waiting
+        template<typename ...Args>
+        static callback_pool::key_t _async_key(const client_id_t &client_id, const Args&...)
+        {
+            return client_id;
+        }
+
+        // the datagrams of a sender without connection (stateless udp) are run in order, the senders in parallel
+        template<typename ...Args>
+        static callback_pool::key_t _async_key(const boost::asio::ip::udp::endpoint &sender, const Args&...)
+        {
+            return udp_peer_key(sender).hash();
+        }
+
+        // the async callbacks of a connection are counted by it until they ran (it may stop receiving meanwhile)
+        template<typename ...Args>
+        static callback_pool::task_t _async_task(callback_pool::task_t task, const Args&...)
+        {
+            return task;
+        }
+
+        template<typename ...Args>
+        static callback_pool::task_t _async_task(callback_pool::task_t task, const connection_t &connection, const Args&...)
+        {
+            return make_counted_task(std::move(task), connection);
+        }
+
     public:
         _HL_INTERNAL_CALLBACK_IMPL_BASE(server_callbacks, m_pool, m_mutex, m_callbacks);
 
@@ -119,22 +183,37 @@ namespace net
 #define _HL_INTERNAL_SERVER_CALLBACK_REGISTER_IMPL_NO_SHARABLE(NAME) \
         _HL_INTERNAL_CALLBACK_REGISTER_IMPL_NO_SHARABLE(NAME, server, m_callbacks, m_pool, m_mutex)
 
-        _HL_INTERNAL_SERVER_CALLBACK_REGISTER_IMPL(on_start_success);
-        _HL_INTERNAL_SERVER_CALLBACK_REGISTER_IMPL_NO_SHARABLE(on_stop_success);
-        _HL_INTERNAL_SERVER_CALLBACK_REGISTER_IMPL_NO_SHARABLE(on_stop_error);
-        _HL_INTERNAL_SERVER_CALLBACK_REGISTER_IMPL(on_connection);
-        _HL_INTERNAL_SERVER_CALLBACK_REGISTER_IMPL(on_connection_error);
-        _HL_INTERNAL_SERVER_CALLBACK_REGISTER_IMPL(on_disconnection);
-        _HL_INTERNAL_SERVER_CALLBACK_REGISTER_IMPL(on_disconnection_error);
-        _HL_INTERNAL_SERVER_CALLBACK_REGISTER_IMPL(on_sent);
-        _HL_INTERNAL_SERVER_CALLBACK_REGISTER_IMPL(on_send_error);
-        _HL_INTERNAL_SERVER_CALLBACK_REGISTER_IMPL(on_receive);
-        _HL_INTERNAL_SERVER_CALLBACK_REGISTER_IMPL(on_receive_error);
+// Every event of the register, with or without the server given to the callback
+#define _HL_INTERNAL_SERVER_CALLBACKS(SHARABLE, NO_SHARABLE) \
+        SHARABLE(on_start_success) \
+        NO_SHARABLE(on_stop_success) \
+        NO_SHARABLE(on_stop_error) \
+        SHARABLE(on_connection) \
+        SHARABLE(on_connection_error) \
+        SHARABLE(on_disconnection) \
+        SHARABLE(on_disconnection_error) \
+        SHARABLE(on_sent) \
+        SHARABLE(on_send_error) \
+        SHARABLE(on_writable) \
+        SHARABLE(on_receive) \
+        SHARABLE(on_receive_error) \
+        SHARABLE(on_datagram)
+
+        _HL_INTERNAL_SERVER_CALLBACKS(_HL_INTERNAL_SERVER_CALLBACK_REGISTER_IMPL, _HL_INTERNAL_SERVER_CALLBACK_REGISTER_IMPL_NO_SHARABLE)
 
+    private:
+        void _unsafe_rebuild_handlers(void)
+        {
+            _HL_INTERNAL_SERVER_CALLBACKS(_HL_INTERNAL_CALLBACK_REGISTER_REBUILD_HANDLERS, _HL_INTERNAL_CALLBACK_REGISTER_REBUILD_HANDLERS)
+        }
+
+#undef _HL_INTERNAL_SERVER_CALLBACKS
 #undef _HL_INTERNAL_SERVER_CALLBACK_REGISTER_IMPL
+#undef _HL_INTERNAL_SERVER_CALLBACK_REGISTER_IMPL_NO_SHARABLE
 
+    public:
         server_callback_register(std::function<server_t(void)> get_sharable)
-            : m_pool(false)
+            : m_pool()
             , m_callbacks()
             , m_mutex()
             , m_get_sharable(get_sharable)
@@ -0,0 +1,518 @@
+/*
+This code is licensed under the GNU GPL v3.
+Copyright: (C) 2024 Mattis DALLEAU
+*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "HelNet/server/abstract_connection_unwrapped.hpp"
+#include "HelNet/server/utils.hpp"
+
+#ifndef HL_NET_CONNECTION_TABLE_SHARDS
+    // Shards of the connections table of a server, a power of two
+    #define HL_NET_CONNECTION_TABLE_SHARDS 32
+#endif
+
+#ifndef HL_NET_CONNECTION_TABLE_BLOCK_SLOTS
+    // Slots allocated at once by a shard of the connections table
+    #define HL_NET_CONNECTION_TABLE_BLOCK_SLOTS 256
+#endif
+
+#ifndef HL_NET_CONNECTION_TABLE_MAX_BLOCKS
+    // Blocks of slots per shard, the table holds at most SHARDS * MAX_BLOCKS * BLOCK_SLOTS connections
+    #define HL_NET_CONNECTION_TABLE_MAX_BLOCKS 512
+#endif
+
+static_assert(HL_NET_CONNECTION_TABLE_SHARDS > 0 && (HL_NET_CONNECTION_TABLE_SHARDS & (HL_NET_CONNECTION_TABLE_SHARDS - 1)) == 0,
+              "HL_NET_CONNECTION_TABLE_SHARDS must be a power of two");
+static_assert(static_cast<std::uint64_t>(HL_NET_CONNECTION_TABLE_SHARDS) * HL_NET_CONNECTION_TABLE_MAX_BLOCKS * HL_NET_CONNECTION_TABLE_BLOCK_SLOTS < std::numeric_limits<std::uint32_t>::max(),
+              "the slots of the connections table must fit in the 32 bits index of a client id");
+
+namespace hl
+{
+namespace net
+{
+    using client_holder_name_to_id_t = utils::back_and_forth_unordered_map<std::string, client_id_t>;
+
+    // A client id is a slot of the connections table (low 32 bits) and the generation of that slot (high 32 bits),
+    // the generation is bumped every time the slot is freed so that the id of a gone connection never finds the next one.
+    static inline std::uint32_t client_id_slot(const client_id_t &client_id)
+    {
+        return static_cast<std::uint32_t>(client_id);
+    }
+
+    static inline std::uint32_t client_id_generation(const client_id_t &client_id)
+    {
+        return static_cast<std::uint32_t>(client_id >> 32);
+    }
+
+    static inline client_id_t make_client_id(const std::uint32_t slot, const std::uint32_t generation)
+    {
+        return (static_cast<client_id_t>(generation) << 32) | slot;
+    }
+
+    // Connections of a server, a slot map split in shards by slot.
+    // An id is resolved in O(1) without lock: the slot is found by index and its id compared with the one asked,
+    // the readers only bump the readers count of the shard. The writers (accept, disconnect) lock their shard,
+    // a connection leaving its slot is kept alive until no reader of the shard may still use it.
+    // The free slots are reused last freed first, the endpoint names are a secondary index with its own mutex.
+    class connection_table final : public hl::silva::collections::meta::NonCopyMoveable
+    {
+    private:
+        struct slot final : public hl::silva::collections::meta::NonCopyMoveable
+        {
+            // the readers load the connection then the id, the writers publish the connection before the id
+            // and unpublish the id before the connection
+            std::atomic<base_abstract_connection_unwrapped*> connection;
+            std::atomic<client_id_t> id;
+            connection_t owner;         // writers only
+            std::uint32_t generation;   // writers only
+
+            slot()
+                : connection(nullptr)
+                , id(INVALID_CLIENT_ID)
+                , owner(nullptr)
+                , generation(0)
+            {}
+        };
+
+        struct alignas(64) shard final : public hl::silva::collections::meta::NonCopyMoveable
+        {
+            std::atomic<size_t> readers;
+            std::array<std::atomic<slot*>, HL_NET_CONNECTION_TABLE_MAX_BLOCKS> blocks;
+
+            std::mutex write_mutex;
+            std::vector<std::unique_ptr<slot[]>> owned_blocks;
+            std::vector<std::uint32_t> free_slots;  // local indexes
+            std::uint32_t used_slots;               // local indexes below it were handed out once
+            std::vector<connection_t> retired;
+            std::atomic_bool has_retired;
+
+            shard()
+                : readers(0)
+                , blocks()
+                , write_mutex()
+                , owned_blocks()
+                , free_slots()
+                , used_slots(0)
+                , retired()
+                , has_retired(false)
+            {
+                for (std::atomic<slot*> &block : blocks)
+                {
+                    block = nullptr;
+                }
+            }
+        };
+
+        // keeps the connections read from a shard alive until it is destroyed
+        class reader final
+        {
+        private:
+            shard &m_shard;
+
+        public:
+            explicit reader(shard &pinned)
+                : m_shard(pinned)
+            {
+                m_shard.readers.fetch_add(1);
+            }
+
+            reader(const reader &) = delete;
+            reader& operator=(const reader &) = delete;
+
+            ~reader()
+            {
+                if (m_shard.readers.fetch_sub(1) == 1 && m_shard.has_retired.load())
+                {
+                    _try_release_retired(m_shard);
+                }
+            }
+        };
+
+        // the readers only update the readers count of the shards
+        mutable std::array<shard, HL_NET_CONNECTION_TABLE_SHARDS> m_shards;
+        std::atomic<size_t> m_next_shard;
+
+        mutable std::mutex m_names_mutex;
+        client_holder_name_to_id_t m_names;
+
+        static std::uint32_t _shard_index(const std::uint32_t slot_index)
+        {
+            return slot_index & (HL_NET_CONNECTION_TABLE_SHARDS - 1);
+        }
+
+        static std::uint32_t _local_index(const std::uint32_t slot_index)
+        {
+            return slot_index / HL_NET_CONNECTION_TABLE_SHARDS;
+        }
+
+        // null when the slot was never allocated
+        static slot* _find_slot(const shard &target, const std::uint32_t local_index)
+        {
+            const size_t block = local_index / HL_NET_CONNECTION_TABLE_BLOCK_SLOTS;
+            if (block >= HL_NET_CONNECTION_TABLE_MAX_BLOCKS)
+            {
+                return nullptr;
+            }
+            slot *slots = target.blocks[block].load();
+            return slots ? &slots[local_index % HL_NET_CONNECTION_TABLE_BLOCK_SLOTS] : nullptr;
+        }
+
+        // the connection of client_id, only valid while a reader of its shard is alive
+        base_abstract_connection_unwrapped* _unsafe_resolve(const client_id_t &client_id) const
+        {
+            const std::uint32_t slot_index = client_id_slot(client_id);
+            const slot *found = _find_slot(m_shards[_shard_index(slot_index)], _local_index(slot_index));
+            if (!found)
+            {
+                return nullptr;
+            }
+            base_abstract_connection_unwrapped *connection = found->connection.load();
+            return connection && found->id.load() == client_id ? connection : nullptr;
+        }
+
+        // frees the retired connections outside of the lock, their destructors may call back into the server
+        static void _try_release_retired(shard &target)
+        {
+            std::vector<connection_t> released;
+            {
+                std::unique_lock<std::mutex> lock(target.write_mutex, std::try_to_lock);
+                if (!lock.owns_lock() || target.readers.load() != 0)
+                {
+                    return; // the writer holding the lock releases them itself
+                }
+                released.swap(target.retired);
+                target.has_retired = false;
+            }
+        }
+
+        // called with the shard locked, the retired connections are moved to released once no reader is left
+        static void _unsafe_retire(shard &target, slot &freed, const std::uint32_t local_index, std::vector<connection_t> &released)
+        {
+            freed.id.store(INVALID_CLIENT_ID);
+            freed.connection.store(nullptr);
+            target.retired.push_back(std::move(freed.owner));
+            freed.owner = nullptr;
+            ++freed.generation;
+            target.free_slots.push_back(local_index);
+
+            // a reader starting from now cannot find the connection, none is left on it once there are no readers
+            if (target.readers.load() == 0)
+            {
+                released.swap(target.retired);
+                target.has_retired = false;
+            }
+            else
+            {
+                target.has_retired = true;
+            }
+        }
+
+        // a free local index of the shard, false when the shard is full
+        static bool _unsafe_allocate(shard &target, std::uint32_t &local_index)
+        {
+            if (!target.free_slots.empty())
+            {
+                local_index = target.free_slots.back();
+                target.free_slots.pop_back();
+                return true;
+            }
+
+            const size_t block = target.used_slots / HL_NET_CONNECTION_TABLE_BLOCK_SLOTS;
+            if (block >= HL_NET_CONNECTION_TABLE_MAX_BLOCKS)
+            {
+                return false;
+            }
+            if (target.used_slots % HL_NET_CONNECTION_TABLE_BLOCK_SLOTS == 0)
+            {
+                target.owned_blocks.emplace_back(new slot[HL_NET_CONNECTION_TABLE_BLOCK_SLOTS]);
+                target.blocks[block].store(target.owned_blocks.back().get());
+            }
+            local_index = target.used_slots++;
+            return true;
+        }
+
+    public:
+        connection_table()
+            : m_shards()
+            , m_next_shard(0)
+            , m_names_mutex()
+            , m_names()
+        {}
+
+        ~connection_table() = default;
+
+        connection_t find(const client_id_t &client_id) const
+        {
+            if (client_id == INVALID_CLIENT_ID)
+            {
+                return nullptr;
+            }
+            const reader pin(m_shards[_shard_index(client_id_slot(client_id))]);
+            base_abstract_connection_unwrapped *connection = _unsafe_resolve(client_id);
+            return connection ? connection->shared_from_this() : nullptr;
+        }
+
+        bool contains(const client_id_t &client_id) const
+        {
+            if (client_id == INVALID_CLIENT_ID)
+            {
+                return false;
+            }
+            const reader pin(m_shards[_shard_index(client_id_slot(client_id))]);
+            return _unsafe_resolve(client_id) != nullptr;
+        }
+
+        // calls function(connection&) without taking a reference on the connection,
+        // returns its result or on_missing when client_id is unknown
+        template<typename ReturnType, typename Function>
+        ReturnType apply(const client_id_t &client_id, const Function &function, const ReturnType &on_missing) const
+        {
+            if (client_id == INVALID_CLIENT_ID)
+            {
+                return on_missing;
+            }
+            const reader pin(m_shards[_shard_index(client_id_slot(client_id))]);
+            base_abstract_connection_unwrapped *connection = _unsafe_resolve(client_id);
+            return connection ? function(*connection) : on_missing;
+        }
+
+        // INVALID_CLIENT_ID when unknown
+        client_id_t find_id(const std::string &name) const
+        {
+            std::lock_guard<std::mutex> lock(m_names_mutex);
+            client_holder_name_to_id_t::const_forward_iterator it = m_names.find_forward(name);
+            return it == m_names.end_forward() ? INVALID_CLIENT_ID : it->second;
+        }
+
+        // gives the connection a free slot then publishes it and indexes its name, INVALID_CLIENT_ID when the table is full
+        client_id_t insert(const connection_t &connection, const std::string &name)
+        {
+            const client_id_t client_id = insert(connection);
+            if (client_id == INVALID_CLIENT_ID)
+            {
+                return INVALID_CLIENT_ID;
+            }
+
+            std::lock_guard<std::mutex> lock(m_names_mutex);
+            m_names.insert(name, client_id);
+            return client_id;
+        }
+
+        // without a name, the server resolves the endpoint ids of such connections itself
+        client_id_t insert(const connection_t &connection)
+        {
+            client_id_t client_id = INVALID_CLIENT_ID;
+            const size_t first_shard = m_next_shard.fetch_add(1, std::memory_order_relaxed);
+            for (size_t offset = 0; offset < HL_NET_CONNECTION_TABLE_SHARDS && client_id == INVALID_CLIENT_ID; ++offset)
+            {
+                const std::uint32_t shard_index = static_cast<std::uint32_t>((first_shard + offset) & (HL_NET_CONNECTION_TABLE_SHARDS - 1));
+                shard &target = m_shards[shard_index];
+                std::lock_guard<std::mutex> lock(target.write_mutex);
+
+                std::uint32_t local_index = 0;
+                if (!_unsafe_allocate(target, local_index))
+                {
+                    continue;
+                }
+                slot &allocated = *_find_slot(target, local_index);
+                client_id = make_client_id(local_index * HL_NET_CONNECTION_TABLE_SHARDS + shard_index, allocated.generation);
+
+                connection->set_id(client_id);
+                allocated.owner = connection;
+                allocated.connection.store(connection.get());
+                allocated.id.store(client_id);
+            }
+            return client_id;
+        }
+
+        // the removed connection, null when unknown
+        connection_t erase(const client_id_t &client_id)
+        {
+            if (client_id == INVALID_CLIENT_ID)
+            {
+                return nullptr;
+            }
+
+            connection_t connection(nullptr);
+            std::vector<connection_t> released;
+            {
+                const std::uint32_t slot_index = client_id_slot(client_id);
+                shard &target = m_shards[_shard_index(slot_index)];
+                std::lock_guard<std::mutex> lock(target.write_mutex);
+                slot *found = _find_slot(target, _local_index(slot_index));
+                if (!found || found->id.load() != client_id)
+                {
+                    return nullptr;
+                }
+                connection = found->owner;
+                _unsafe_retire(target, *found, _local_index(slot_index), released);
+            }
+
+            std::lock_guard<std::mutex> lock(m_names_mutex);
+            client_holder_name_to_id_t::const_backward_iterator it = m_names.find_backward(client_id);
+            if (it != m_names.end_backward())
+            {
+                m_names.erase(it);
+            }
+            return connection;
+        }
+
+        // every connection at the time of the call
+        std::vector<connection_t> snapshot() const
+        {
+            std::vector<connection_t> connections;
+            for (shard &current : m_shards)
+            {
+                const reader pin(current);
+                for (size_t block = 0; block < HL_NET_CONNECTION_TABLE_MAX_BLOCKS; ++block)
+                {
+                    const slot *slots = current.blocks[block].load();
+                    if (!slots)
+                    {
+                        break;
+                    }
+                    for (size_t i = 0; i < HL_NET_CONNECTION_TABLE_BLOCK_SLOTS; ++i)
+                    {
+                        base_abstract_connection_unwrapped *connection = slots[i].connection.load();
+                        if (connection && slots[i].id.load() != INVALID_CLIENT_ID)
+                        {
+                            connections.push_back(connection->shared_from_this());
+                        }
+                    }
+                }
+            }
+            return connections;
+        }
+
+        // removes and stops every connection, the slots keep their generation so the ids of this run stay unknown.
+        // A connection still held elsewhere is stopped too, it would otherwise send on a socket the server dropped.
+        void clear()
+        {
+            std::vector<connection_t> removed;
+            for (shard &current : m_shards)
+            {
+                std::vector<connection_t> released;
+                std::lock_guard<std::mutex> lock(current.write_mutex);
+                for (std::uint32_t local_index = 0; local_index < current.used_slots; ++local_index)
+                {
+                    slot &used = *_find_slot(current, local_index);
+                    if (used.id.load() != INVALID_CLIENT_ID)
+                    {
+                        removed.push_back(used.owner);
+                        _unsafe_retire(current, used, local_index, released);
+                    }
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_names_mutex);
+                m_names.clear();
+            }
+
+            // outside of the locks, stop() may call back into the server
+            for (const connection_t &connection : removed)
+            {
+                if (connection->is_running())
+                {
+                    connection->stop();
+                }
+            }
+        }
+    };
+
+    // Client id bound to the connections table of its server, to keep in the callbacks instead of a connection_t:
+    // copying it and sending through it never touch the reference count of the connection.
+    // The server must outlive the handle, a handle whose connection is gone fails its sends.
+    class connection_handle final
+    {
+    private:
+        const connection_table *m_table;
+        client_id_t m_id;
+
+    public:
+        connection_handle()
+            : m_table(nullptr)
+            , m_id(INVALID_CLIENT_ID)
+        {}
+
+        connection_handle(const connection_table &table, const client_id_t &client_id)
+            : m_table(&table)
+            , m_id(client_id)
+        {}
+
+        connection_handle(const connection_handle &) = default;
+        connection_handle& operator=(const connection_handle &) = default;
+        ~connection_handle() = default;
+
+        const client_id_t& get_id() const
+        {
+            return m_id;
+        }
+
+        // false once the connection left the server
+        bool connected() const
+        {
+            return m_table && m_table->contains(m_id);
+        }
+
+        // null once the connection left the server
+        connection_t lock() const
+        {
+            return m_table ? m_table->find(m_id) : nullptr;
+        }
+
+        send_result send(const shared_buffer_t &buffer, const size_t &size) const
+        {
+            if (!m_table)
+            {
+                return false;
+            }
+            return m_table->apply(m_id, [&buffer, &size](base_abstract_connection_unwrapped &connection) -> send_result {
+                return connection.send(buffer, size);
+            }, send_result());
+        }
+
+        send_result send(const shared_buffer_t &buffer, const size_t &size, const send_completion_t &completion) const
+        {
+            if (!m_table)
+            {
+                return false;
+            }
+            return m_table->apply(m_id, [&buffer, &size, &completion](base_abstract_connection_unwrapped &connection) -> send_result {
+                return connection.send(buffer, size, completion);
+            }, send_result());
+        }
+
+        send_result send(const shared_buffer_sequence_t &buffers) const
+        {
+            if (!m_table)
+            {
+                return false;
+            }
+            return m_table->apply(m_id, [&buffers](base_abstract_connection_unwrapped &connection) -> send_result {
+                return connection.send(buffers);
+            }, send_result());
+        }
+
+        bool operator==(const connection_handle &other) const
+        {
+            return m_table == other.m_table && m_id == other.m_id;
+        }
+
+        bool operator!=(const connection_handle &other) const
+        {
+            return !(*this == other);
+        }
+    };
+}
+}
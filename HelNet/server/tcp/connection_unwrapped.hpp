@@ -5,9 +5,14 @@ Copyright: (C) 2024 Mattis DALLEAU
 
 #pragma once
 
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/dispatch.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/io_service.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/write.hpp>
 #include <boost/smart_ptr.hpp>
+#include "HelNet/mpsc_queue.hpp"
 #include "HelNet/server/abstract_connection_unwrapped.hpp"
 
 namespace hl
@@ -21,14 +26,33 @@ namespace net
 
     private:
         boost::asio::ip::tcp::socket m_socket;
+        // every socket operation is started and completed on it, so the handlers of a connection never run concurrently
+        io_strand_t m_strand;
+        // start/stop and receives, the sends only go through the send queue
         std::mutex m_mutex_api_control_flow;
 
+        // a buffer or a sequence waiting for its turn to be written
+        struct send_request final
+        {
+            shared_buffer_t buffer = nullptr;
+            size_t size = 0;
+            shared_buffer_sequence_holder_t sequence = nullptr;
+            send_completion_t completion = nullptr;
+        };
+
+        // filled by the senders without lock, drained on the strand one write at a time
+        mpsc_queue<send_request> m_send_queue;
+        // held by the strand while a write is in flight, taken by the sender that finds it free
+        std::atomic_bool m_send_scheduled;
+        // messages of the write in flight and their buffers, strand only
+        std::vector<send_request> m_write_batch;
+        std::vector<boost::asio::const_buffer> m_write_views;
+
         void _receive_async_callback(const boost::system::error_code &ec,
                                     size_t bytes_transferred,
-                                    connection_t connection,
-                                    shared_buffer_t receive_buffer)
+                                    connection_t connection)
         {
-            shared_buffer_t buffer_cpy = make_shared_buffer(receive_buffer, bytes_transferred);
+            shared_buffer_t buffer_cpy = take_receive_buffer(bytes_transferred);
 
             HL_NET_LOG_DEBUG("Received {} bytes from connection: {}", bytes_transferred, get_alias());
             if (ec)
@@ -57,15 +81,19 @@ namespace net
                 this->callbacks_register().on_receive(connection, buffer_cpy, bytes_transferred);
             }
 
-            _receive_async();
+            if (keep_receiving())
+            {
+                _receive_async();
+            }
         }
 
 
         void _receive_async()
         {
+            // declared before the lock: releasing the last reference calls stop() which takes it
+            connection_t connection = shared_from_this();
             std::lock_guard<std::mutex> lock(m_mutex_api_control_flow);
 
-            connection_t connection = shared_from_this();
             shared_buffer_t buffer = receive_buffer();
 
             if (!healthy())
@@ -78,11 +106,11 @@ namespace net
             HL_NET_LOG_DEBUG("Start reading for connection: {}", get_id());
 
             m_socket.async_receive(
-                boost::asio::buffer(*buffer),
-                [this, connection, buffer]
+                boost::asio::buffer(buffer->data(), buffer->capacity()),
+                boost::asio::bind_executor(m_strand, [this, connection]
                 (const boost::system::error_code &ec, const size_t &bytes_transferred) {
-                    _receive_async_callback(ec, bytes_transferred, connection, buffer);
-                }
+                    _receive_async_callback(ec, bytes_transferred, connection);
+                })
             );
         }
 
@@ -93,11 +121,15 @@ namespace net
                                 const client_is_unhealthy_notifier_t& notify_client_as_unhealthy_to_the_server)
             : base_abstract_connection_unwrapped(callback_register, notify_server_as_unhealthy, notify_client_as_unhealthy_to_the_server)
             , m_socket(io_service)
+            , m_strand(io_service.get_executor())
             , m_mutex_api_control_flow()
+            , m_send_queue()
+            , m_send_scheduled(false)
+            , m_write_batch()
+            , m_write_views()
         {
-            HL_NET_LOG_TRACE("Creating connection_t: {}", get_alias());
-            set_run_status(true);
-            set_health_status(true);
+            HL_NET_LOG_TRACE("Creating connection_t: {}", static_cast<const void*>(this));
+            _init_status(true, true);
         }
 
     public:
@@ -142,39 +174,148 @@ namespace net
         }
     
     private:
-        void _send_async_callback(const boost::system::error_code &ec, const size_t bytes_transferred, connection_t connexion)
+        void _on_send_error(const boost::system::error_code &ec)
+        {
+            HL_NET_LOG_WARN("Error on send to connection: {} with error: {}", get_alias(), ec.message());
+            switch (ec.value())
+            {
+            _HL_INTERNAL_UNHEALTHY_CASES_CONNECTION_UNHEALTHY:
+                HL_NET_LOG_ERROR("Connection cannot send data to: {} due to {}, stopping receive, connection is not healthy!", get_alias(), ec.message());
+                this->set_health_status(false);
+                notify_client_as_unhealthy_to_the_server();
+                break;
+            _HL_INTERNAL_UNHEALTHY_CASES_SERVER_FROM_CONNECTION:
+                HL_NET_LOG_ERROR("Connection cannot send data to: {} due to {}, stopping receive, server & connection is not healthy!", get_alias(), ec.message());
+                notify_server_as_unhealthy();
+                break;
+            default:
+                break;
+            }
+        }
+
+        // reports every message of the batch, the ones fully covered by bytes_transferred are sent even on error
+        void _on_batch_written(const connection_t &connexion, const boost::system::error_code &ec, const size_t bytes_transferred)
         {
-            HL_NET_LOG_DEBUG("Sent {} bytes to connection: {}", bytes_transferred, get_alias());
+            HL_NET_LOG_DEBUG("Sent {} bytes in {} messages to connection: {}", bytes_transferred, m_write_batch.size(), get_alias());
 
+            const bool per_batch = get_sent_notification() == sent_notification::per_batch;
             if (ec)
             {
-                HL_NET_LOG_WARN("Error on send to connection: {} with error: {}", get_alias(), ec.message());
-                this->callbacks_register().on_send_error(connexion, ec, bytes_transferred);
-                switch (ec.value())
+                _on_send_error(ec);
+                if (per_batch)
                 {
-                _HL_INTERNAL_UNHEALTHY_CASES_CONNECTION_UNHEALTHY:
-                    HL_NET_LOG_ERROR("Connection cannot send data to: {} due to {}, stopping receive, connection is not healthy!", get_alias(), ec.message());
-                    this->set_health_status(false);
-                    notify_client_as_unhealthy_to_the_server();
-                    break;
-                _HL_INTERNAL_UNHEALTHY_CASES_SERVER_FROM_CONNECTION:
-                    HL_NET_LOG_ERROR("Connection cannot send data to: {} due to {}, stopping receive, server & connection is not healthy!", get_alias(), ec.message());
-                    notify_server_as_unhealthy();
-                    break;
-                default:
-                    break;
+                    this->callbacks_register().on_send_error(connexion, ec, bytes_transferred);
                 }
             }
-            else
+            else if (per_batch)
             {
                 this->callbacks_register().on_sent(connexion, bytes_transferred);
             }
+
+            size_t remaining = bytes_transferred;
+            size_t batch_size = 0;
+            for (const send_request &request : m_write_batch)
+            {
+                const size_t size = request.sequence ? request.sequence->size : request.size;
+                const bool sent = !ec || remaining >= size;
+                const size_t written = sent ? size : remaining;
+                remaining -= written;
+                batch_size += size;
+
+                if (!per_batch)
+                {
+                    if (sent)
+                    {
+                        this->callbacks_register().on_sent(connexion, written);
+                    }
+                    else
+                    {
+                        this->callbacks_register().on_send_error(connexion, ec, written);
+                    }
+                }
+                if (request.completion)
+                {
+                    request.completion(sent ? boost::system::error_code() : ec, written);
+                }
+            }
+            m_write_batch.clear();
+            m_write_views.clear();
+            release_send_bytes(connexion, batch_size);
+
+            _write_next_batch(connexion);
+        }
+
+        // the sender that finds the queue idle hands it to the strand, the others only push
+        send_result _queue_send(const connection_t &connexion, send_request request, const size_t size)
+        {
+            const send_result result = queue_send_bytes(size);
+            m_send_queue.push(std::move(request));
+            if (!m_send_scheduled.exchange(true))
+            {
+                boost::asio::dispatch(m_strand, [this, connexion]() { _write_next_batch(connexion); });
+            }
+            return result;
+        }
+
+        // on the strand with m_send_scheduled held: gathers the queued messages in a single write whose completion
+        // starts the next one, releases the queue once it is empty
+        void _write_next_batch(const connection_t &connexion)
+        {
+            while (true)
+            {
+                size_t bytes = 0;
+                send_request request;
+                while (m_write_views.size() < HL_NET_TCP_MAX_WRITE_BUFFERS && bytes < HL_NET_TCP_MAX_WRITE_BYTES && m_send_queue.unsafe_pop(request))
+                {
+                    if (request.sequence)
+                    {
+                        m_write_views.insert(m_write_views.end(), request.sequence->views.begin(), request.sequence->views.end());
+                        bytes += request.sequence->size;
+                    }
+                    else
+                    {
+                        m_write_views.emplace_back(request.buffer->data(), request.size);
+                        bytes += request.size;
+                    }
+                    m_write_batch.push_back(std::move(request));
+                }
+
+                if (!m_write_batch.empty())
+                {
+                    // async_write loops on the partial writes until every byte of the batch is written
+                    boost::asio::async_write(
+                        m_socket,
+                        m_write_views,
+                        boost::asio::bind_executor(m_strand, [this, connexion](const boost::system::error_code &ec, const size_t bytes_transferred) {
+                            _on_batch_written(connexion, ec, bytes_transferred);
+                        })
+                    );
+                    return;
+                }
+
+                if (!m_send_queue.unsafe_empty())
+                {
+                    // a sender is linking its request, retry after the other handlers of the strand
+                    boost::asio::post(m_strand, [this, connexion]() { _write_next_batch(connexion); });
+                    return;
+                }
+                m_send_scheduled = false;
+                // a request pushed before the release was not seen by its sender as needing a write
+                if (m_send_queue.unsafe_empty() || m_send_scheduled.exchange(true))
+                {
+                    return;
+                }
+            }
         }
 
     public:
-        bool send(const shared_buffer_t &buffer, const size_t &size) override final
+        send_result send(const shared_buffer_t &buffer, const size_t &size) override final
+        {
+            return send(buffer, size, nullptr);
+        }
+
+        send_result send(const shared_buffer_t &buffer, const size_t &size, const send_completion_t &completion) override final
         {
-            std::lock_guard<std::mutex> lock(m_mutex_api_control_flow);
             connection_t connexion = shared_from_this();
 
             HL_NET_LOG_DEBUG("Preparing sending {} bytes to: {}", size, get_alias());
@@ -207,19 +348,65 @@ namespace net
             {
                 HL_NET_LOG_DEBUG("Sending {} bytes to connection: {}", size, get_alias());
 
-                m_socket.async_send(
-                    boost::asio::buffer(*buffer, size),
-                    [this, connexion](const boost::system::error_code &ec, const size_t bytes_transferred) {
-                        _send_async_callback(ec, bytes_transferred, connexion);
-                    }
-                );
-                return true;
+                send_request request;
+                request.buffer = buffer;
+                request.size = size;
+                request.completion = completion;
+                return _queue_send(connexion, std::move(request), size);
             }
         }
 
+        send_result send(const shared_buffer_sequence_t &buffers) override final
+        {
+            connection_t connexion = shared_from_this();
+
+            HL_NET_LOG_DEBUG("Preparing sending {} buffers to: {}", buffers.size(), get_alias());
+
+            if (!healthy())
+            {
+                HL_NET_LOG_ERROR("Cannot send data to a non-healthy connection: {}", get_alias());
+                callbacks_register().on_send_error(connexion, boost::asio::error::not_connected, 0);
+                return false;
+            }
+
+            const shared_buffer_sequence_holder_t sequence = make_shared_buffer_sequence_holder(buffers);
+            if (!sequence)
+            {
+                HL_NET_LOG_ERROR("Cannot send data from a null buffer to: {}", get_alias());
+                callbacks_register().on_send_error(connexion, boost::asio::error::invalid_argument, 0);
+                return false;
+            }
+            else if (!sequence->size)
+            {
+                HL_NET_LOG_ERROR("Cannot send 0 bytes to: {}", get_alias());
+                callbacks_register().on_send_error(connexion, boost::asio::error::invalid_argument, 0);
+                return false;
+            }
+
+            HL_NET_LOG_DEBUG("Sending {} bytes in {} buffers to connection: {}", sequence->size, buffers.size(), get_alias());
+            send_request request;
+            request.sequence = sequence;
+            return _queue_send(connexion, std::move(request), sequence->size);
+        }
+
         void start_receive()
         {
-            _receive_async();
+            connection_t connection = shared_from_this();
+            boost::asio::dispatch(m_strand, [this, connection]() {
+                if (keep_receiving())
+                {
+                    _receive_async();
+                }
+            });
+        }
+
+    protected:
+        void _restart_receive() override final
+        {
+            if (is_running())
+            {
+                start_receive();
+            }
         }
     };
 }
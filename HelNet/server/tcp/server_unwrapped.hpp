@@ -5,6 +5,9 @@ Copyright: (C) 2024 Mattis DALLEAU
 
 #pragma once
 
+#include <memory>
+#include <vector>
+
 #include <boost/asio/ip/tcp.hpp>
 #include "HelNet/server/abstract_server_unwrapped.hpp"
 #include "HelNet/server/tcp/connection_unwrapped.hpp"
@@ -22,9 +25,11 @@ namespace net
         using shared_tcp_connection_t = typename tcp_connection_t::shared_t;
 
     private:
-        boost::asio::ip::tcp::acceptor m_acceptor;
+        // one acceptor per shard bound with SO_REUSEPORT (a single one spreading the connections when not supported)
+        std::vector<std::unique_ptr<boost::asio::ip::tcp::acceptor>> m_acceptors;
+        std::atomic<size_t> m_next_shard;
 
-        void _async_accept_callback(const boost::system::error_code &ec, shared_tcp_connection_t connection)
+        void _async_accept_callback(const boost::system::error_code &ec, shared_tcp_connection_t connection, const size_t acceptor)
         {
             if (ec)
             {
@@ -44,14 +49,30 @@ namespace net
             {
                 HL_NET_LOG_DEBUG("Accepted connection for server: {}", get_alias());
                 base_abstract_connection_unwrapped::shared_t conn_callback = boost::static_pointer_cast<base_abstract_connection_unwrapped>(connection);
-                _set_connection<true>(conn_callback, utils::endpoint_to_string(connection->socket().remote_endpoint()));
-                connection->start_receive();
-                callbacks_register().on_connection(conn_callback);
+                if (_set_connection(conn_callback, utils::endpoint_to_string(connection->socket().remote_endpoint())))
+                {
+                    connection->start_receive();
+                    callbacks_register().on_connection(conn_callback);
+                }
+                else
+                {
+                    connection->stop();
+                    callbacks_register().on_connection_error(boost::asio::error::no_buffer_space);
+                }
+            }
+            _accept_async(acceptor);
+        }
+
+        size_t _shard_of_next_connection(const size_t acceptor)
+        {
+            if (m_acceptors.size() == _io_shards())
+            {
+                return acceptor;
             }
-            _accept_async();
+            return m_next_shard.fetch_add(1, std::memory_order_relaxed) % _io_shards();
         }
 
-        void _accept_async()
+        void _accept_async(const size_t acceptor)
         {
             if (!healthy())
             {
@@ -63,21 +84,74 @@ namespace net
             std::lock_guard<std::mutex> lock_flow(m_mutex_api_control_flow);
 
             shared_tcp_connection_t connection = tcp_connection_t::make(
-                _io_service(),
+                _io_service(_shard_of_next_connection(acceptor)),
                 callbacks_register(),
                 make_server_is_unhealthy_notifier(),
                 make_client_is_unhealthy_notifier()
             );
+            _setup_receive(connection);
+            _setup_send(connection);
 
-            m_acceptor.async_accept(
+            m_acceptors[acceptor]->async_accept(
                 connection->socket(),
-                [this, connection](const boost::system::error_code &ec) -> void { this->_async_accept_callback(ec, connection); }
+                [this, connection, acceptor](const boost::system::error_code &ec) -> void { this->_async_accept_callback(ec, connection, acceptor); }
             );
         }
 
+        bool _open_acceptor(boost::asio::ip::tcp::acceptor &acceptor,
+                            const boost::asio::ip::tcp::endpoint &endpoint,
+                            const bool reuse_port)
+        {
+            boost::system::error_code ec;
+
+            acceptor.open(endpoint.protocol(), ec);
+            if (ec)
+            {
+                HL_NET_LOG_ERROR("Failed to open acceptor: {} for {}", ec.message(), get_alias());
+                return false;
+            }
+
+            acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true), ec);
+            if (ec)
+            {
+                HL_NET_LOG_ERROR("Failed to set reuse address on acceptor: {} for {}", ec.message(), get_alias());
+                return false;
+            }
+
+#if HL_NET_HAS_REUSE_PORT
+            if (reuse_port)
+            {
+                acceptor.set_option(utils::reuse_port(true), ec);
+                if (ec)
+                {
+                    HL_NET_LOG_ERROR("Failed to set reuse port on acceptor: {} for {}", ec.message(), get_alias());
+                    return false;
+                }
+            }
+#else
+            (void)reuse_port;
+#endif
+
+            acceptor.bind(endpoint, ec);
+            if (ec)
+            {
+                HL_NET_LOG_ERROR("Failed to bind acceptor for: {}", get_alias());
+                return false;
+            }
+
+            acceptor.listen(MAX_CONNECTIONS, ec);
+            if (ec)
+            {
+                HL_NET_LOG_ERROR("Failed to listen acceptor for: {}", get_alias());
+                return false;
+            }
+            return true;
+        }
+
         tcp_server_unwrapped()
             : base_abstract_server_unwrapped()
-            , m_acceptor(_io_service())
+            , m_acceptors()
+            , m_next_shard(0)
         {
             HL_NET_LOG_TRACE("Creating tcp_server_unwrapped: {}", get_alias());
         }
@@ -119,40 +193,34 @@ namespace net
 
                 boost::asio::ip::tcp::endpoint const endpoint(boost::asio::ip::tcp::v4(), vport);
 
-                boost::system::error_code ec;
-
-                m_acceptor.open(boost::asio::ip::tcp::v4(), ec);
-                if (ec)
-                {
-                    HL_NET_LOG_ERROR("Failed to open acceptor: {} for {}", ec.message(), get_alias());
-                    return false;
-                }
-
-                m_acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
-                if (ec)
-                {
-                    HL_NET_LOG_ERROR("Failed to set reuse address on acceptor: {} for {}", ec.message(), get_alias());
-                    return false;
-                }
-
-                m_acceptor.bind(endpoint, ec);
-                if (ec)
+                const size_t io_shards = _unsafe_prepare_io_shards();
+                size_t acceptors = io_shards;
+#if !HL_NET_HAS_REUSE_PORT
+                if (io_shards > 1)
                 {
-                    HL_NET_LOG_ERROR("Failed to bind acceptor for: {}", get_alias());
-                    return false;
+                    HL_NET_LOG_WARN("SO_REUSEPORT is not supported, a single acceptor spreads the connections over the {} shards of: {}", io_shards, get_alias());
+                    acceptors = 1;
                 }
+#endif
 
-                m_acceptor.listen(MAX_CONNECTIONS, ec);
-                if (ec)
+                m_acceptors.clear();
+                for (size_t shard = 0; shard < acceptors; ++shard)
                 {
-                    HL_NET_LOG_ERROR("Failed to listen acceptor for: {}", get_alias());
-                    return false;
+                    m_acceptors.emplace_back(new boost::asio::ip::tcp::acceptor(_io_service(shard)));
+                    if (!_open_acceptor(*m_acceptors.back(), endpoint, acceptors > 1))
+                    {
+                        m_acceptors.clear();
+                        return false;
+                    }
                 }
 
                 _unsafe_start();
             }
 
-            _accept_async();
+            for (size_t acceptor = 0; acceptor < m_acceptors.size(); ++acceptor)
+            {
+                _accept_async(acceptor);
+            }
 
             callbacks_register().on_start_success();
             HL_NET_LOG_DEBUG("Server ready: {} on 0.0.0.0:{}", get_alias(), port);
@@ -161,17 +229,25 @@ namespace net
 
         bool stop() override final
         {
-            std::lock_guard<std::mutex> lock_flow(m_mutex_api_control_flow);
-            HL_NET_LOG_DEBUG("Stopping server: {}", get_alias());
-
-            if (is_running() == false)
             {
-                HL_NET_LOG_WARN("Tried to stop already stopped server: {}", get_alias());
-                callbacks_register().on_stop_error(boost::asio::error::not_connected);
-                return false;
+                std::lock_guard<std::mutex> lock_flow(m_mutex_api_control_flow);
+                HL_NET_LOG_DEBUG("Stopping server: {}", get_alias());
+
+                if (is_running() == false)
+                {
+                    HL_NET_LOG_WARN("Tried to stop already stopped server: {}", get_alias());
+                    callbacks_register().on_stop_error(boost::asio::error::not_connected);
+                    return false;
+                }
+
+                set_run_status(false);
+                for (const std::unique_ptr<boost::asio::ip::tcp::acceptor> &acceptor : m_acceptors)
+                {
+                    acceptor->close();
+                }
             }
 
-            m_acceptor.close();
+            // joins the io threads, whose handlers may be waiting on m_mutex_api_control_flow
             _unsafe_stop();
 
             HL_NET_LOG_DEBUG("Stopped server: {}", get_alias());
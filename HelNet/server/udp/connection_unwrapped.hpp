@@ -5,24 +5,221 @@ Copyright: (C) 2024 Mattis DALLEAU
 
 #pragma once
 
+#include <mutex>
+#include <vector>
+
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/dispatch.hpp>
 #include <boost/asio/ip/udp.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/enable_shared_from_this.hpp>
 
+#include "HelNet/mpsc_queue.hpp"
 #include "HelNet/server/abstract_connection_unwrapped.hpp"
+#include "HelNet/server/udp/peer_table.hpp"
 #include "HelNet/server/utils.hpp"
+#include "HelNet/udp_segmentation.hpp"
+
+#if HL_NET_HAS_UDP_MMSG
+    #include <cerrno>
+    #include <sys/socket.h>
+    #include <sys/uio.h>
+#endif
 
 namespace hl
 {
 namespace net
 {
+    class udp_connection_unwrapped;
+
+    // Datagrams of the udp connections of a server socket: queued without lock by the senders and written on the
+    // strand of the socket, up to HL_NET_UDP_BATCH_SIZE of them with a single sendmmsg.
+    // A send bigger than the segment size is split in datagrams by the kernel (UDP_SEGMENT) or else by the queue.
+    // The sends of a stateless server have no connection, only the endpoint they go to.
+    // It owns the socket: the connections of the socket and the pending handlers keep both alive.
+    class udp_send_queue final : public boost::enable_shared_from_this<udp_send_queue>, public hl::silva::collections::meta::NonCopyMoveable
+    {
+    public:
+        using shared_t = boost::shared_ptr<udp_send_queue>;
+
+        struct request final
+        {
+            boost::shared_ptr<udp_connection_unwrapped> connection = nullptr;
+            shared_buffer_t buffer = nullptr;
+            size_t size = 0;
+            shared_buffer_sequence_holder_t sequence = nullptr;
+            send_completion_t completion = nullptr;
+            size_t offset = 0; // bytes already written, strand only
+            boost::asio::ip::udp::endpoint endpoint = boost::asio::ip::udp::endpoint(); // without connection only
+        };
+
+    private:
+        boost::asio::ip::udp::socket m_socket;
+        io_strand_t m_strand;
+        mpsc_queue<request> m_queue;
+        // held by the strand while it writes or waits for the socket, taken by the sender that finds it free
+        std::atomic_bool m_scheduled;
+        // datagrams being written, strand only
+        std::vector<request> m_batch;
+        size_t m_segment_size;
+        // the kernel splits the segmented sends, cleared on the strand if it refuses to
+        bool m_gso;
+#if HL_NET_HAS_UDP_MMSG
+        // a datagram of the batch: the bytes [offset, offset + length) of a request
+        struct datagram final
+        {
+            size_t owner;
+            size_t offset;
+            size_t length;
+        };
+        std::vector<datagram> m_datagrams;
+        std::vector<mmsghdr> m_headers;
+        std::vector<iovec> m_iovecs;
+#else
+        std::vector<boost::asio::const_buffer> m_views;
+#endif
+
+        // reports the datagram to its connection, or else to the completion of the send
+        void _complete(request &sent, const boost::system::error_code &ec, const size_t bytes_transferred);
+        const boost::asio::ip::udp::endpoint &_destination(const request &queued) const;
+        // on the strand with m_scheduled held, releases it once the queue is empty
+        void _flush();
+#if !HL_NET_HAS_UDP_MMSG
+        // completion of the datagram at the front of the batch
+        void _on_sent(const boost::system::error_code &ec, const size_t bytes_transferred);
+#endif
+
+        // bytes of a request of `size` written as one datagram from `offset`, all of them when the queue does not split it
+        size_t _datagram_length(const size_t size, const size_t offset) const
+        {
+            const size_t left = size - offset;
+            return m_segment_size && !m_gso ? std::min(m_segment_size, left) : left;
+        }
+
+        // calls on_view(data, size) for the bytes [offset, offset + length) of the request
+        template<typename OnView>
+        static void _for_each_view(const request &queued, const size_t offset, const size_t length, OnView on_view)
+        {
+            if (queued.sequence)
+            {
+                utils::for_each_view_in_range(queued.sequence->views, offset, length, on_view);
+            }
+            else
+            {
+                on_view(queued.buffer->data() + offset, length);
+            }
+        }
+
+        // a device without checksum offload makes the kernel fail the segmented sends with EIO, they are split by the queue from then on
+        bool _segmentation_refused(const boost::system::error_code &ec)
+        {
+            if (!m_gso || ec != boost::system::errc::io_error)
+            {
+                return false;
+            }
+            HL_NET_LOG_WARN("UDP_SEGMENT refused by the kernel, the segmented sends are split by the server");
+            m_gso = false;
+#if HL_NET_HAS_UDP_GSO
+            utils::set_udp_segment_size(m_socket.native_handle(), 0);
+#endif
+            return true;
+        }
+
+        // false when the queue was released, true when the flush goes on
+        bool _release()
+        {
+            if (!m_queue.unsafe_empty())
+            {
+                // a sender is linking its request, retry after the other handlers of the strand
+                const shared_t self = shared_from_this();
+                boost::asio::post(m_strand, [self]() { self->_flush(); });
+                return false;
+            }
+            m_scheduled = false;
+            // a request pushed before the release was not seen by its sender as needing a flush
+            return !m_queue.unsafe_empty() && !m_scheduled.exchange(true);
+        }
+
+    public:
+        explicit udp_send_queue(boost::asio::io_service &io_service)
+            : m_socket(io_service)
+            , m_strand(io_service.get_executor())
+            , m_queue()
+            , m_scheduled(false)
+            , m_batch()
+            , m_segment_size(0)
+            , m_gso(false)
+#if HL_NET_HAS_UDP_MMSG
+            , m_datagrams()
+            , m_headers()
+            , m_iovecs()
+#else
+            , m_views()
+#endif
+        {
+            m_batch.reserve(HL_NET_UDP_BATCH_SIZE);
+        }
+
+        ~udp_send_queue() = default;
+
+        boost::asio::ip::udp::socket &socket()
+        {
+            return m_socket;
+        }
+
+        const boost::asio::ip::udp::socket &socket() const
+        {
+            return m_socket;
+        }
+
+        // before the socket is used, `gso` when the kernel accepted UDP_SEGMENT for `segment_size`
+        void set_segmentation(const size_t segment_size, const bool gso)
+        {
+            m_segment_size = segment_size;
+            m_gso = segment_size && gso;
+        }
+
+        size_t segment_size() const
+        {
+            return m_segment_size;
+        }
+
+        void push(request queued)
+        {
+            m_queue.push(std::move(queued));
+            if (!m_scheduled.exchange(true))
+            {
+                const shared_t self = shared_from_this();
+                boost::asio::dispatch(m_strand, [self]() { self->_flush(); });
+            }
+        }
+
+        // once the io threads are joined: drops the datagrams left, their requests hold the connections that hold the queue
+        void clear()
+        {
+            request dropped;
+            while (m_queue.unsafe_pop(dropped))
+            {
+            }
+            m_batch.clear();
+        }
+    };
+
     class udp_connection_unwrapped final : public base_abstract_connection_unwrapped
     {
+        friend class udp_send_queue;
+
     public:
         using shared_t = boost::shared_ptr<udp_connection_unwrapped>;
     
     private:
-        boost::asio::ip::udp::socket &m_socket;
+        // owns the server socket, shared by every udp connection of that socket
+        const udp_send_queue::shared_t m_send_queue;
         const boost::asio::ip::udp::endpoint m_endpoint;
-        const std::string m_endpoint_str;
+        const udp_peer_key m_key;
+        // "address:port", only built once asked for
+        mutable std::once_flag m_endpoint_str_once;
+        mutable std::string m_endpoint_str;
 
         std::mutex m_mutex_api_control_flow;
 
@@ -30,18 +227,23 @@ namespace net
                                 const server_is_unhealthy_notifier_t& notify_server_as_unhealthy,
                                 const client_is_unhealthy_notifier_t& notify_client_as_unhealthy_to_the_server,
                                 const boost::asio::ip::udp::endpoint &endpoint,
-                                boost::asio::ip::udp::socket &socket)
+                                const udp_send_queue::shared_t &send_queue)
             : base_abstract_connection_unwrapped(callback_register, notify_server_as_unhealthy, notify_client_as_unhealthy_to_the_server)
-            , m_socket(socket)
+            , m_send_queue(send_queue)
             , m_endpoint(endpoint)
-            , m_endpoint_str(utils::endpoint_to_string(endpoint))
+            , m_key(endpoint)
+            , m_endpoint_str_once()
+            , m_endpoint_str()
             , m_mutex_api_control_flow()
         {
-            HL_NET_LOG_DEBUG("Creating udp_connection_unwrapped: {}", get_alias());
-            set_run_status(true);
-            set_health_status(true);
+            HL_NET_LOG_DEBUG("Creating udp_connection_unwrapped: {}", static_cast<const void*>(this));
+            _init_status(true, true);
+        }
 
-            set_alias(fmt::format("udp_connection_unwrapped({})", m_endpoint_str));
+    protected:
+        std::string _default_alias() const override final
+        {
+            return get_endpoint_id();
         }
 
     public:
@@ -49,9 +251,9 @@ namespace net
                             const server_is_unhealthy_notifier_t& notify_server_as_unhealthy,
                             const client_is_unhealthy_notifier_t& notify_client_as_unhealthy_to_the_server,
                             const boost::asio::ip::udp::endpoint &endpoint,
-                            boost::asio::ip::udp::socket &socket)
+                            const udp_send_queue::shared_t &send_queue)
         {
-            return shared_t(new udp_connection_unwrapped(callback_register, notify_server_as_unhealthy, notify_client_as_unhealthy_to_the_server, endpoint, socket));
+            return shared_t(new udp_connection_unwrapped(callback_register, notify_server_as_unhealthy, notify_client_as_unhealthy_to_the_server, endpoint, send_queue));
         }
 
         const boost::asio::ip::udp::endpoint &endpoint()
@@ -59,6 +261,17 @@ namespace net
             return m_endpoint;
         }
 
+        const udp_peer_key &peer_key() const
+        {
+            return m_key;
+        }
+
+        // socket of the server that received the traffic of the peer, the replies go out on it
+        const boost::asio::ip::udp::socket &socket() const
+        {
+            return m_send_queue->socket();
+        }
+
         virtual ~udp_connection_unwrapped() override final
         {
             HL_NET_LOG_TRACE("Destroying udp_connection_unwrapped: {}", get_alias());
@@ -88,11 +301,12 @@ namespace net
 
         const std::string& get_endpoint_id() const
         {
+            std::call_once(m_endpoint_str_once, [this]() { m_endpoint_str = utils::endpoint_to_string(m_endpoint); });
             return m_endpoint_str;
         }
     
     private:
-        void _send_async_connexion_callback(const boost::system::error_code &ec, const size_t bytes_transferred, connection_t connexion)
+        void _send_async_connexion_callback(const boost::system::error_code &ec, const size_t bytes_transferred, const size_t size, connection_t connexion, const send_completion_t &completion)
         {
             HL_NET_LOG_DEBUG("Sent {} bytes to connection: {}", bytes_transferred, get_alias());
             if (ec)
@@ -118,10 +332,21 @@ namespace net
             {
                 this->callbacks_register().on_sent(connexion, bytes_transferred);
             }
+
+            if (completion)
+            {
+                completion(ec, bytes_transferred);
+            }
+            release_send_bytes(connexion, size);
         }
 
     public:
-        bool send(const shared_buffer_t &buffer, const size_t &size) override
+        send_result send(const shared_buffer_t &buffer, const size_t &size) override
+        {
+            return send(buffer, size, nullptr);
+        }
+
+        send_result send(const shared_buffer_t &buffer, const size_t &size, const send_completion_t &completion) override
         {
             connection_t connexion = shared_from_this();
 
@@ -149,19 +374,230 @@ namespace net
                 callbacks_register().on_send_error(connexion, boost::system::error_code(boost::asio::error::invalid_argument), 0);
                 return false;
             }
+            else if (!utils::udp_segmentable(size, m_send_queue->segment_size()))
+            {
+                HL_NET_LOG_ERROR("Cannot send {} bytes in segments of {} bytes to connection: {}", size, m_send_queue->segment_size(), get_alias());
+                callbacks_register().on_send_error(connexion, boost::system::error_code(boost::asio::error::message_size), 0);
+                return false;
+            }
 
             HL_NET_LOG_DEBUG("Sending {} bytes to connection: {}", size, get_alias());
-            m_socket.async_send_to(
-                boost::asio::buffer(*buffer, size),
-                m_endpoint,
-                [this, buffer, connexion]
-                (const boost::system::error_code &ec, const size_t bytes_transferred)
+            const send_result result = queue_send_bytes(size);
+            udp_send_queue::request request;
+            request.connection = boost::static_pointer_cast<udp_connection_unwrapped>(connexion);
+            request.buffer = buffer;
+            request.size = size;
+            request.completion = completion;
+            m_send_queue->push(std::move(request));
+            return result;
+        }
+
+        send_result send(const shared_buffer_sequence_t &buffers) override
+        {
+            connection_t connexion = shared_from_this();
+
+            if (!healthy())
+            {
+                HL_NET_LOG_ERROR("Cannot send data to a non-healthy connection: {}", get_alias());
+                callbacks_register().on_send_error(connexion, boost::system::error_code(boost::asio::error::not_connected), 0);
+                return false;
+            }
+
+            const shared_buffer_sequence_holder_t sequence = make_shared_buffer_sequence_holder(buffers);
+            if (!sequence)
+            {
+                HL_NET_LOG_ERROR("Cannot send data from a null buffer to: {}", get_alias());
+                callbacks_register().on_send_error(connexion, boost::system::error_code(boost::asio::error::invalid_argument), 0);
+                return false;
+            }
+            else if (!sequence->size)
+            {
+                HL_NET_LOG_ERROR("Cannot send 0 bytes to: {}", get_alias());
+                callbacks_register().on_send_error(connexion, boost::system::error_code(boost::asio::error::invalid_argument), 0);
+                return false;
+            }
+            else if (!utils::udp_segmentable(sequence->size, m_send_queue->segment_size()))
+            {
+                HL_NET_LOG_ERROR("Cannot send {} bytes in segments of {} bytes to connection: {}", sequence->size, m_send_queue->segment_size(), get_alias());
+                callbacks_register().on_send_error(connexion, boost::system::error_code(boost::asio::error::message_size), 0);
+                return false;
+            }
+
+            HL_NET_LOG_DEBUG("Sending {} bytes in {} buffers to connection: {}", sequence->size, buffers.size(), get_alias());
+            const send_result result = queue_send_bytes(sequence->size);
+            udp_send_queue::request request;
+            request.connection = boost::static_pointer_cast<udp_connection_unwrapped>(connexion);
+            request.sequence = sequence;
+            request.size = sequence->size;
+            m_send_queue->push(std::move(request));
+            return result;
+        }
+    };
+
+    inline void udp_send_queue::_complete(request &sent, const boost::system::error_code &ec, const size_t bytes_transferred)
+    {
+        if (sent.connection)
+        {
+            const connection_t connexion = sent.connection;
+            sent.connection->_send_async_connexion_callback(ec, bytes_transferred, sent.size, connexion, sent.completion);
+            return;
+        }
+
+        if (ec)
+        {
+            HL_NET_LOG_WARN("Error on send to: {} with error: {}", utils::endpoint_to_string(sent.endpoint), ec.message());
+        }
+        if (sent.completion)
+        {
+            sent.completion(ec, bytes_transferred);
+        }
+    }
+
+    inline const boost::asio::ip::udp::endpoint &udp_send_queue::_destination(const request &queued) const
+    {
+        return queued.connection ? queued.connection->m_endpoint : queued.endpoint;
+    }
+
+#if HL_NET_HAS_UDP_MMSG
+    inline void udp_send_queue::_flush()
+    {
+        while (true)
+        {
+            request popped;
+            while (m_batch.size() < HL_NET_UDP_BATCH_SIZE && m_queue.unsafe_pop(popped))
+            {
+                m_batch.push_back(std::move(popped));
+            }
+            if (m_batch.empty())
+            {
+                if (_release())
                 {
-                    _send_async_connexion_callback(ec, bytes_transferred, connexion);
+                    continue;
                 }
-            );
-            return true;
+                return;
+            }
+
+            // the datagrams are cut first, so the iovecs can be reserved before the headers point into them
+            m_datagrams.clear();
+            size_t iovecs = 0;
+            for (size_t i = 0; i < m_batch.size() && m_datagrams.size() < HL_NET_UDP_BATCH_SIZE; ++i)
+            {
+                const request &queued = m_batch[i];
+                const size_t views = queued.sequence ? queued.sequence->views.size() : 1;
+                for (size_t offset = queued.offset; offset < queued.size && m_datagrams.size() < HL_NET_UDP_BATCH_SIZE; )
+                {
+                    const size_t length = _datagram_length(queued.size, offset);
+                    m_datagrams.push_back({ i, offset, length });
+                    iovecs += views;
+                    offset += length;
+                }
+            }
+            m_iovecs.clear();
+            m_iovecs.reserve(iovecs);
+            m_headers.resize(m_datagrams.size());
+
+            for (size_t i = 0; i < m_datagrams.size(); ++i)
+            {
+                const datagram &cut = m_datagrams[i];
+                const request &queued = m_batch[cut.owner];
+                const size_t first = m_iovecs.size();
+                _for_each_view(queued, cut.offset, cut.length, [this](const byte *data, const size_t size) {
+                    m_iovecs.push_back({ const_cast<byte *>(data), size });
+                });
+
+                mmsghdr &header = m_headers[i];
+                header = mmsghdr();
+                const boost::asio::ip::udp::endpoint &destination = _destination(queued);
+                header.msg_hdr.msg_name = const_cast<void *>(static_cast<const void *>(destination.data()));
+                header.msg_hdr.msg_namelen = static_cast<socklen_t>(destination.size());
+                header.msg_hdr.msg_iov = m_iovecs.data() + first;
+                header.msg_hdr.msg_iovlen = m_iovecs.size() - first;
+            }
+
+            const int sent = ::sendmmsg(m_socket.native_handle(), m_headers.data(), static_cast<unsigned int>(m_headers.size()), MSG_DONTWAIT);
+            if (sent < 0)
+            {
+                const boost::system::error_code error(errno, boost::system::system_category());
+                if (error == boost::asio::error::would_block)
+                {
+                    // the socket buffer is full, the batch is written again once it drained
+                    const shared_t self = shared_from_this();
+                    m_socket.async_wait(boost::asio::ip::udp::socket::wait_write,
+                        boost::asio::bind_executor(m_strand, [self](const boost::system::error_code &) { self->_flush(); }));
+                    return;
+                }
+                if (_segmentation_refused(error))
+                {
+                    continue;
+                }
+                // the first datagram is the one that failed, its request ends there and the others are tried again
+                _complete(m_batch.front(), error, m_batch.front().offset);
+                m_batch.erase(m_batch.begin());
+                continue;
+            }
+
+            for (size_t i = 0; i < static_cast<size_t>(sent); ++i)
+            {
+                m_batch[m_datagrams[i].owner].offset += m_datagrams[i].length;
+            }
+            size_t written = 0;
+            while (written < m_batch.size() && m_batch[written].offset == m_batch[written].size)
+            {
+                _complete(m_batch[written], boost::system::error_code(), m_batch[written].size);
+                ++written;
+            }
+            m_batch.erase(m_batch.begin(), m_batch.begin() + static_cast<std::ptrdiff_t>(written));
         }
-    };
+    }
+#else
+    // one async_send_to at a time, the queue only spares the senders a dispatch on the strand
+    inline void udp_send_queue::_flush()
+    {
+        if (m_batch.empty())
+        {
+            request popped;
+            while (!m_queue.unsafe_pop(popped))
+            {
+                if (!_release())
+                {
+                    return;
+                }
+            }
+            m_batch.push_back(std::move(popped));
+        }
+
+        const request &queued = m_batch.front();
+        m_views.clear();
+        _for_each_view(queued, queued.offset, _datagram_length(queued.size, queued.offset), [this](const byte *data, const size_t size) {
+            m_views.emplace_back(data, size);
+        });
+        const shared_t self = shared_from_this();
+        m_socket.async_send_to(m_views, _destination(queued),
+            boost::asio::bind_executor(m_strand, [self](const boost::system::error_code &ec, const size_t bytes_transferred) {
+                self->_on_sent(ec, bytes_transferred);
+            })
+        );
+    }
+
+    inline void udp_send_queue::_on_sent(const boost::system::error_code &ec, const size_t bytes_transferred)
+    {
+        // the batch was dropped by clear() when the server stopped before the completion ran
+        if (!m_batch.empty())
+        {
+            request &sent = m_batch.front();
+            if (ec && !_segmentation_refused(ec))
+            {
+                _complete(sent, ec, sent.offset);
+                m_batch.clear();
+            }
+            else if (!ec && (sent.offset += bytes_transferred) >= sent.size)
+            {
+                _complete(sent, ec, sent.size);
+                m_batch.clear();
+            }
+        }
+        _flush();
+    }
+#endif
 }
 }
@@ -0,0 +1,220 @@
+/*
+This code is licensed under the GNU GPL v3.
+Copyright: (C) 2024 Mattis DALLEAU
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/ip/udp.hpp>
+
+#include "HelNet/base.hpp"
+
+namespace hl
+{
+namespace net
+{
+    // Address and port of a udp peer read from the sockaddr the kernel filled, compared and hashed without
+    // building an asio address. The zero key (no family) is the empty slot of the peer tables.
+    class udp_peer_key final
+    {
+    private:
+        std::uint64_t m_family_port; // family | port << 16 | ipv6 scope << 32
+        std::uint64_t m_address[2];  // ipv4: first 4 bytes, ipv6: the 16 bytes
+
+    public:
+        udp_peer_key()
+            : m_family_port(0)
+            , m_address()
+        {}
+
+        // the fields are read by value, a key written in pieces then read by word would stall the store forwarding
+        explicit udp_peer_key(const boost::asio::ip::udp::endpoint &endpoint)
+            : m_family_port(0)
+            , m_address()
+        {
+            const char *raw = reinterpret_cast<const char *>(endpoint.data());
+            if (endpoint.data()->sa_family == AF_INET6)
+            {
+                std::uint16_t port = 0;
+                std::uint32_t scope = 0;
+                std::memcpy(&port, raw + offsetof(sockaddr_in6, sin6_port), sizeof(port));
+                std::memcpy(&scope, raw + offsetof(sockaddr_in6, sin6_scope_id), sizeof(scope));
+                std::memcpy(&m_address[0], raw + offsetof(sockaddr_in6, sin6_addr), sizeof(m_address[0]));
+                std::memcpy(&m_address[1], raw + offsetof(sockaddr_in6, sin6_addr) + sizeof(m_address[0]), sizeof(m_address[1]));
+                m_family_port = AF_INET6 | static_cast<std::uint64_t>(port) << 16 | static_cast<std::uint64_t>(scope) << 32;
+            }
+            else
+            {
+                std::uint16_t port = 0;
+                std::uint32_t address = 0;
+                std::memcpy(&port, raw + offsetof(sockaddr_in, sin_port), sizeof(port));
+                std::memcpy(&address, raw + offsetof(sockaddr_in, sin_addr), sizeof(address));
+                m_address[0] = address;
+                m_family_port = AF_INET | static_cast<std::uint64_t>(port) << 16;
+            }
+        }
+
+        bool empty() const
+        {
+            return !m_family_port;
+        }
+
+        bool operator==(const udp_peer_key &other) const
+        {
+            return m_family_port == other.m_family_port && m_address[0] == other.m_address[0] && m_address[1] == other.m_address[1];
+        }
+
+        bool operator!=(const udp_peer_key &other) const
+        {
+            return !(*this == other);
+        }
+
+        // the address is mixed by a multiply before the port joins it, so a port and an address that vary together
+        // cannot cancel out. A product bit only depends on the bits below it: the high half of each product is folded
+        // back, the low bits that index the tables depend on the port as much as on every byte of the address
+        std::uint64_t hash() const
+        {
+            const std::uint64_t address = (m_address[0] ^ (m_address[1] << 29 | m_address[1] >> 35)) * 0x9e3779b97f4a7c15UL;
+            const std::uint64_t mixed = (address ^ (address >> 32) ^ m_family_port) * 0x9e3779b97f4a7c15UL;
+            return mixed ^ (mixed >> 32);
+        }
+    };
+
+    // Open addressing table keyed by udp peer: linear probing in a power of two array kept at most half full,
+    // an erase shifts the following entries of the probe back instead of leaving a tombstone. Not thread safe.
+    template<typename Value>
+    class udp_peer_table final
+    {
+    private:
+        struct entry final
+        {
+            udp_peer_key key;
+            Value value;
+
+            entry()
+                : key()
+                , value()
+            {}
+        };
+
+        HL_NET_STATIC_CONSTEXPR size_t MIN_CAPACITY = 16;
+
+        std::vector<entry> m_entries;
+        size_t m_size;
+
+        size_t _mask() const
+        {
+            return m_entries.size() - 1;
+        }
+
+        // slot holding the key, or the empty slot ending its probe
+        size_t _probe(const udp_peer_key &key) const
+        {
+            size_t index = static_cast<size_t>(key.hash() & _mask());
+            while (!m_entries[index].key.empty() && m_entries[index].key != key)
+            {
+                index = (index + 1) & _mask();
+            }
+            return index;
+        }
+
+        void _grow()
+        {
+            std::vector<entry> previous(m_entries.size() * 2);
+            previous.swap(m_entries);
+            for (entry &moved : previous)
+            {
+                if (!moved.key.empty())
+                {
+                    m_entries[_probe(moved.key)] = std::move(moved);
+                }
+            }
+        }
+
+        void _erase_at(size_t hole)
+        {
+            for (size_t next = (hole + 1) & _mask(); !m_entries[next].key.empty(); next = (next + 1) & _mask())
+            {
+                // an entry whose home is cyclically in (hole, next] is still reachable, the others move into the hole
+                const size_t home = static_cast<size_t>(m_entries[next].key.hash() & _mask());
+                const bool reachable = hole <= next ? (hole < home && home <= next) : (hole < home || home <= next);
+                if (!reachable)
+                {
+                    m_entries[hole] = std::move(m_entries[next]);
+                    hole = next;
+                }
+            }
+            m_entries[hole] = entry();
+            --m_size;
+        }
+
+    public:
+        udp_peer_table()
+            : m_entries(MIN_CAPACITY)
+            , m_size(0)
+        {}
+
+        ~udp_peer_table() = default;
+
+        // null when unknown, valid until the next insert or erase
+        Value *find(const udp_peer_key &key)
+        {
+            entry &found = m_entries[_probe(key)];
+            return found.key.empty() ? nullptr : &found.value;
+        }
+
+        const Value *find(const udp_peer_key &key) const
+        {
+            const entry &found = m_entries[_probe(key)];
+            return found.key.empty() ? nullptr : &found.value;
+        }
+
+        // false when the key is already in the table
+        bool insert(const udp_peer_key &key, const Value &value)
+        {
+            if ((m_size + 1) * 2 > m_entries.size())
+            {
+                _grow();
+            }
+            entry &slot = m_entries[_probe(key)];
+            if (!slot.key.empty())
+            {
+                return false;
+            }
+            slot.key = key;
+            slot.value = value;
+            ++m_size;
+            return true;
+        }
+
+        // removes the key only while it still maps to `value`
+        bool erase(const udp_peer_key &key, const Value &value)
+        {
+            const size_t index = _probe(key);
+            if (m_entries[index].key.empty() || !(m_entries[index].value == value))
+            {
+                return false;
+            }
+            _erase_at(index);
+            return true;
+        }
+
+        void clear()
+        {
+            std::vector<entry>(MIN_CAPACITY).swap(m_entries);
+            m_size = 0;
+        }
+
+        size_t size() const
+        {
+            return m_size;
+        }
+    };
+}
+}
@@ -5,6 +5,10 @@ Copyright: (C) 2024 Mattis DALLEAU
 
 #pragma once
 
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
 #include <boost/asio/ip/udp.hpp>
 #include <boost/bind/bind.hpp>
 #include <boost/asio/placeholders.hpp>
@@ -16,82 +20,325 @@ namespace hl
 {
 namespace net
 {
+#ifndef HL_NET_DEFAULT_UDP_SERVER_RECEIVES
+    // Receives kept in flight on each socket of a udp server, 0 means one per io thread
+    #define HL_NET_DEFAULT_UDP_SERVER_RECEIVES 1
+#endif
+
+    // A receive kept in flight on a udp server socket, with its own buffers and senders
+    struct udp_receive_slot final : public hl::silva::collections::meta::NonCopyMoveable
+    {
+        using shared_t = boost::shared_ptr<udp_receive_slot>;
+
+        receive_buffer_holder receive_buffer;
+#if HL_NET_HAS_UDP_MMSG
+        // a recvmmsg batch, receive_buffer holds the first datagram
+        std::vector<receive_buffer_holder> batch_buffers;
+        std::vector<boost::asio::ip::udp::endpoint> batch_endpoints;
+        std::vector<mmsghdr> batch_headers;
+        std::vector<iovec> batch_iovecs;
+        std::vector<char> batch_controls; // control messages, udp_socket_context::control_size bytes per datagram
+#else
+        boost::asio::ip::udp::endpoint endpoint; // sender of the datagram being received
+#endif
+
+        udp_receive_slot()
+            : receive_buffer()
+#if HL_NET_HAS_UDP_MMSG
+            , batch_buffers(HL_NET_UDP_BATCH_SIZE - 1)
+            , batch_endpoints(HL_NET_UDP_BATCH_SIZE)
+            , batch_headers(HL_NET_UDP_BATCH_SIZE)
+            , batch_iovecs(HL_NET_UDP_BATCH_SIZE)
+            , batch_controls()
+#else
+            , endpoint()
+#endif
+        {}
+
+#if HL_NET_HAS_UDP_MMSG
+        receive_buffer_holder &batch_buffer(const size_t index)
+        {
+            return index ? batch_buffers[index - 1] : receive_buffer;
+        }
+#endif
+    };
+
+    // A socket of the udp server, with one per shard they all bind the port with SO_REUSEPORT.
+    // Its receives complete on any io thread of its shard, they share its peers table under peers_mutex.
+    struct udp_socket_context final : public hl::silva::collections::meta::NonCopyMoveable
+    {
+        using shared_t = boost::shared_ptr<udp_socket_context>;
+        using peers_t = udp_peer_table<connection_t>;
+
+        udp_send_queue::shared_t send_queue; // owns the socket, shared with the connections of the socket
+        boost::asio::ip::udp::socket &socket;
+        std::vector<udp_receive_slot::shared_t> receives;
+        peers_t peers;
+        std::mutex peers_mutex;
+        std::mutex control_flow_mutex; // socket close against the re-arm of the receives
+#if HL_NET_HAS_UDP_MMSG
+        // a single receive waits for the socket to be readable, the others wait here until it hands them the wait
+        // (both under control_flow_mutex): the reactor would wake every receive waiting on the socket for one datagram
+        std::vector<udp_receive_slot::shared_t> idle_receives;
+        bool receive_waiting;
+#endif
+        bool gro; // the receives may hold datagrams coalesced by the kernel
+        bool stateless; // the datagrams go to on_datagram, no connection is made for their peers
+        size_t control_size; // room for the control messages of a received datagram (UDP_GRO, SO_RXQ_OVFL)
+        std::atomic<std::uint32_t> drops; // datagrams the kernel dropped for lack of room, as last reported by a receive
+
+        explicit udp_socket_context(boost::asio::io_service &io_service)
+            : send_queue(boost::make_shared<udp_send_queue>(io_service))
+            , socket(send_queue->socket())
+            , receives()
+            , peers()
+            , peers_mutex()
+            , control_flow_mutex()
+#if HL_NET_HAS_UDP_MMSG
+            , idle_receives()
+            , receive_waiting(false)
+#endif
+            , gro(false)
+            , stateless(false)
+            , control_size(0)
+            , drops(0)
+        {}
+
+        // the counter of the kernel wraps, a receive completing late must not move it back
+        void report_drops(const std::uint32_t reported)
+        {
+            std::uint32_t known = drops;
+            while (static_cast<std::int32_t>(reported - known) > 0 && !drops.compare_exchange_weak(known, reported))
+            {
+            }
+        }
+    };
+
     class udp_server_unwrapped final : public base_abstract_server_unwrapped
     {
     public:
         using shared_t = boost::shared_ptr<udp_server_unwrapped>;
         using udp_connection_t = udp_connection_unwrapped;
         using shared_udp_connection_t = typename udp_connection_t::shared_t;
+        using socket_context_t = udp_socket_context;
 
     private:
-        boost::asio::ip::udp::socket m_socket;
-        boost::asio::ip::udp::endpoint m_endpoint;
+        std::vector<socket_context_t::shared_t> m_sockets;
+        // resolves the endpoint ids given to the api, the datagrams only look up the peers of their socket
+        mutable std::mutex m_endpoint_ids_mutex;
+        udp_peer_table<client_id_t> m_endpoint_ids;
+        std::atomic<size_t> m_udp_segment_size;
+        std::atomic_bool m_udp_gro;
+        std::atomic_bool m_stateless;
+        std::atomic<size_t> m_udp_receives;
+
+        connection_t _get_or_make_connection(socket_context_t &context, const boost::asio::ip::udp::endpoint &sender)
+        {
+            const udp_peer_key key(sender);
+            std::unique_lock<std::mutex> lock(context.peers_mutex);
+            if (const connection_t *found = context.peers.find(key))
+            {
+                return *found;
+            }
 
-        shared_buffer_t m_receive_buffer;
+            // connecting the client to the server, under the lock so a concurrent receive of the peer finds it
+            HL_NET_LOG_DEBUG("Connecting new client to server: {}", get_alias());
 
-        void _receive_async_callback(const boost::system::error_code &ec, const size_t bytes_transferred)
+            connection_t connection = boost::static_pointer_cast<base_abstract_connection_unwrapped>(udp_connection_t::make(
+                callbacks_register(),
+                make_server_is_unhealthy_notifier(),
+                make_client_is_unhealthy_notifier(),
+                sender,
+                context.send_queue
+            ));
+            _setup_send(connection);
+            if (!_set_connection(connection))
+            {
+                lock.unlock();
+                callbacks_register().on_connection_error(boost::asio::error::no_buffer_space);
+                return nullptr;
+            }
+            context.peers.insert(key, connection);
+            {
+                std::lock_guard<std::mutex> lock_ids(m_endpoint_ids_mutex);
+                m_endpoint_ids.insert(key, connection->get_id());
+            }
+            lock.unlock();
+            callbacks_register().on_connection(connection);
+            HL_NET_LOG_DEBUG("Connected new client {} to server: {}", connection->get_id(), get_alias());
+            return connection;
+        }
+
+        void _on_receive_error(const socket_context_t::shared_t &context, const udp_receive_slot::shared_t &slot, const boost::system::error_code &ec, shared_buffer_t &buffer_cpy, const size_t bytes_transferred)
         {
-            shared_buffer_t buffer_cpy = make_shared_buffer(m_receive_buffer, bytes_transferred);
+            HL_NET_LOG_WARN("Error on receive for server: {} with error: {}", get_alias(), ec.message());
+            switch (ec.value())
+            {
+            // TODO: Better error handling
+            _HL_INTERNAL_UNHEALTHY_CASES_CONNECTION_UNHEALTHY:
+            _HL_INTERNAL_UNHEALTHY_CASES_SERVER_FROM_CONNECTION:
+                HL_NET_LOG_ERROR("Server cannot receive data due to {}, stopping receive, server is not healthy!", ec.message());
+                set_health_status(false);
+                break;
+            default:
+                break;
+            }
+            connection_t connection(nullptr);
+            callbacks_register().on_receive_error(connection, buffer_cpy, ec, bytes_transferred);
+            _receive_async(context, slot);
+        }
+
+        void _on_datagram(socket_context_t &context, const boost::asio::ip::udp::endpoint &sender, shared_buffer_t &buffer_cpy, const size_t bytes_transferred)
+        {
+            HL_NET_LOG_DEBUG("Received {} bytes from a client", bytes_transferred);
+            if (context.stateless)
+            {
+                callbacks_register().on_datagram(sender, buffer_cpy, bytes_transferred);
+                return;
+            }
 
+            connection_t connection = _get_or_make_connection(context, sender);
+            if (!connection)
+            {
+                // dropped, the connections table is full
+                return;
+            }
+
+            HL_NET_LOG_DEBUG("Received {} bytes from client: {} for server: {}", bytes_transferred, connection->get_id(), get_alias());
+            callbacks_register().on_receive(connection, buffer_cpy, bytes_transferred);
+        }
+
+#if HL_NET_HAS_UDP_MMSG
+        // the socket is readable: takes up to HL_NET_UDP_BATCH_SIZE datagrams with one recvmmsg and dispatches them,
+        // the other receives of the socket meanwhile take the datagrams that keep coming
+        void _receive_batch(const socket_context_t::shared_t &context, const udp_receive_slot::shared_t &slot, const boost::system::error_code &ec)
+        {
             if (ec)
             {
-                HL_NET_LOG_WARN("Error on receive for server: {} with error: {}", get_alias(), ec.message());
-                switch (ec.value())
+                shared_buffer_t buffer_cpy = slot->receive_buffer.take(0);
+                _on_receive_error(context, slot, ec, buffer_cpy, 0);
+                return;
+            }
+
+            for (size_t i = 0; i < HL_NET_UDP_BATCH_SIZE; ++i)
+            {
+                const shared_buffer_t &buffer = slot->batch_buffer(i).current();
+                slot->batch_iovecs[i] = { buffer->data(), buffer->capacity() };
+
+                mmsghdr &header = slot->batch_headers[i];
+                header = mmsghdr();
+                header.msg_hdr.msg_name = slot->batch_endpoints[i].data();
+                header.msg_hdr.msg_namelen = static_cast<socklen_t>(slot->batch_endpoints[i].capacity());
+                header.msg_hdr.msg_iov = &slot->batch_iovecs[i];
+                header.msg_hdr.msg_iovlen = 1;
+                if (context->control_size)
                 {
-                // TODO: Better error handling
-                _HL_INTERNAL_UNHEALTHY_CASES_CONNECTION_UNHEALTHY:
-                _HL_INTERNAL_UNHEALTHY_CASES_SERVER_FROM_CONNECTION:
-                    HL_NET_LOG_ERROR("Server cannot receive data due to {}, stopping receive, server is not healthy!", ec.message());
-                    set_health_status(false);
-                    break;
-                default:
-                    break;
+                    header.msg_hdr.msg_control = &slot->batch_controls[i * context->control_size];
+                    header.msg_hdr.msg_controllen = context->control_size;
                 }
-                connection_t connection(nullptr);
-                callbacks_register().on_receive_error(connection, buffer_cpy, ec, bytes_transferred);
-                _receive_async();
             }
-            else
+
+            const int received = ::recvmmsg(context->socket.native_handle(), slot->batch_headers.data(), HL_NET_UDP_BATCH_SIZE, MSG_DONTWAIT, nullptr);
+            if (received < 0)
             {
-                HL_NET_LOG_DEBUG("Received {} bytes from a client", bytes_transferred);
-                connection_t connection = _lock_connection_and_apply<connection_t>(
-                    [this, buffer_cpy, bytes_transferred](void) -> connection_t 
-                    {
-                        const boost::asio::ip::udp::endpoint endpoint_cpy = m_endpoint;
-                        const std::string endpoint_str = utils::endpoint_to_string(endpoint_cpy);
-                        connection_t fconnection = _get_connection<false>(endpoint_str);
-
-                        // connecting the client to the server 
-                        if (!fconnection)
-                        {
-                            HL_NET_LOG_DEBUG("Connecting new client to server: {}", get_alias());
-
-                            fconnection = boost::static_pointer_cast<base_abstract_connection_unwrapped>(udp_connection_t::make(
-                                callbacks_register(),
-                                make_server_is_unhealthy_notifier(),
-                                make_client_is_unhealthy_notifier(),
-                                m_endpoint,
-                                m_socket
-                            ));
-                            fconnection->set_alias(endpoint_str);
-                            _set_connection<false>(fconnection, endpoint_str);
-                            callbacks_register().on_connection(fconnection);
-                            HL_NET_LOG_DEBUG("Connected new client {} to server: {}", fconnection->get_id(), get_alias());
-                        }
-                        return fconnection;
-                    }
-                );
+                const boost::system::error_code error(errno, boost::system::system_category());
+                if (error == boost::asio::error::would_block || error == boost::asio::error::interrupted)
+                {
+                    _receive_async(context, slot);
+                    return;
+                }
+                shared_buffer_t buffer_cpy = slot->receive_buffer.take(0);
+                _on_receive_error(context, slot, error, buffer_cpy, 0);
+                return;
+            }
 
-                HL_NET_LOG_DEBUG("Received {} bytes from client: {} for server: {}", bytes_transferred, connection->get_id(), get_alias());
+#if HL_NET_HAS_RXQ_OVFL
+            // the counter is the one of the socket when the datagram was queued, the last one is the latest
+            std::uint32_t drops = 0;
+            if (received && context->control_size && utils::rxq_ovfl_drops(slot->batch_headers[static_cast<size_t>(received) - 1].msg_hdr, drops))
+            {
+                context->report_drops(drops);
+            }
+#endif
 
-                callbacks_register().on_receive(connection, buffer_cpy, bytes_transferred);
-                _receive_async();
+            _hand_over_wait(context);
+            for (size_t i = 0; i < static_cast<size_t>(received); ++i)
+            {
+                mmsghdr &header = slot->batch_headers[i];
+                slot->batch_endpoints[i].resize(header.msg_hdr.msg_namelen);
+                const boost::asio::ip::udp::endpoint &sender = slot->batch_endpoints[i];
+
+#if HL_NET_HAS_UDP_GSO
+                if (context->gro)
+                {
+                    // the datagrams are copied out of the receive buffer, kept for the next batch
+                    const byte *received_data = slot->batch_buffer(i).current()->data();
+                    utils::for_each_udp_segment(header.msg_len, utils::udp_gro_segment_size(header.msg_hdr),
+                        [this, &context, &sender, received_data](const size_t offset, const size_t length) {
+                            shared_buffer_t buffer_cpy = make_shared_buffer(received_data + offset, length);
+                            _on_datagram(*context, sender, buffer_cpy, length);
+                        });
+                    continue;
+                }
+#endif
+                shared_buffer_t buffer_cpy = slot->batch_buffer(i).take(header.msg_len);
+                _on_datagram(*context, sender, buffer_cpy, header.msg_len);
+            }
+            _wait_or_idle(context, slot);
+        }
+
+        // called by the waiting receive once it took a batch, an idle receive (if any) waits in its place
+        void _hand_over_wait(const socket_context_t::shared_t &context)
+        {
+            udp_receive_slot::shared_t next(nullptr);
+            {
+                std::lock_guard<std::mutex> lock(context->control_flow_mutex);
+                if (context->idle_receives.empty())
+                {
+                    context->receive_waiting = false;
+                    return;
+                }
+                next = std::move(context->idle_receives.back());
+                context->idle_receives.pop_back();
+            }
+            _receive_async(context, next);
+        }
+
+        // a receive done with its batch waits for the socket again, unless another one already does
+        void _wait_or_idle(const socket_context_t::shared_t &context, const udp_receive_slot::shared_t &slot)
+        {
+            {
+                std::lock_guard<std::mutex> lock(context->control_flow_mutex);
+                if (context->receive_waiting)
+                {
+                    context->idle_receives.push_back(slot);
+                    return;
+                }
+                context->receive_waiting = true;
             }
+            _receive_async(context, slot);
         }
+#else
+        void _receive_async_callback(const socket_context_t::shared_t &context, const udp_receive_slot::shared_t &slot, const boost::system::error_code &ec, const size_t bytes_transferred)
+        {
+            shared_buffer_t buffer_cpy = slot->receive_buffer.take(bytes_transferred);
 
-        void _receive_async()
+            if (ec)
+            {
+                _on_receive_error(context, slot, ec, buffer_cpy, bytes_transferred);
+            }
+            else
+            {
+                _on_datagram(*context, slot->endpoint, buffer_cpy, bytes_transferred);
+                _receive_async(context, slot);
+            }
+        }
+#endif
+
+        // the completions of the receives of a socket are not serialized, each one runs on the io thread that got it
+        void _receive_async(const socket_context_t::shared_t &context, const udp_receive_slot::shared_t &slot)
         {
-            std::lock_guard<std::mutex> lock(m_mutex_api_control_flow);
+            std::lock_guard<std::mutex> lock(context->control_flow_mutex);
 
             if (!healthy())
             {
@@ -104,18 +351,181 @@ namespace net
 
             HL_NET_LOG_DEBUG("Start reading for server: {}", get_alias());
 
-            m_socket.async_receive_from(
-                boost::asio::buffer(*m_receive_buffer),
-                m_endpoint,
-                boost::bind(&udp_server_unwrapped::_receive_async_callback, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)
+#if HL_NET_HAS_UDP_MMSG
+            context->socket.async_wait(boost::asio::ip::udp::socket::wait_read, [this, context, slot](const boost::system::error_code &ec) {
+                _receive_batch(context, slot, ec);
+            });
+#else
+            context->socket.async_receive_from(
+                boost::asio::buffer(slot->receive_buffer.current()->data(), slot->receive_buffer.current()->capacity()),
+                slot->endpoint,
+                boost::bind(&udp_server_unwrapped::_receive_async_callback, this, context, slot, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)
             );
+#endif
+        }
+
+        void _add_receive(socket_context_t &context)
+        {
+            const udp_receive_slot::shared_t slot = boost::make_shared<udp_receive_slot>();
+            _setup_receive(slot->receive_buffer);
+#if HL_NET_HAS_UDP_MMSG
+            for (receive_buffer_holder &holder : slot->batch_buffers)
+            {
+                _setup_receive(holder);
+            }
+            if (context.gro)
+            {
+                // a receive may hold up to 64KiB of coalesced datagrams
+                for (size_t i = 0; i < HL_NET_UDP_BATCH_SIZE; ++i)
+                {
+                    slot->batch_buffer(i).set_provider([]() { return make_uninitialized_shared_buffer(HL_NET_UDP_GRO_BUFFER_SIZE); });
+                }
+            }
+            slot->batch_controls.assign(HL_NET_UDP_BATCH_SIZE * context.control_size, 0);
+#endif
+            context.receives.push_back(slot);
         }
 
+        bool _open_socket(socket_context_t &context, const boost::asio::ip::udp::endpoint &endpoint, const bool reuse_port)
+        {
+            boost::system::error_code ec;
+
+            context.socket.open(endpoint.protocol(), ec);
+            if (ec)
+            {
+                HL_NET_LOG_ERROR("Failed to open socket: {} for {}", ec.message(), get_alias());
+                return false;
+            }
+
+#if HL_NET_HAS_REUSE_PORT
+            if (reuse_port)
+            {
+                context.socket.set_option(utils::reuse_port(true), ec);
+                if (ec)
+                {
+                    HL_NET_LOG_ERROR("Failed to set reuse port on socket: {} for {}", ec.message(), get_alias());
+                    return false;
+                }
+            }
+#else
+            (void)reuse_port;
+#endif
+
+            context.socket.bind(endpoint, ec);
+            if (ec)
+            {
+                HL_NET_LOG_ERROR("Failed to bind socket for: {}", get_alias());
+                return false;
+            }
+
+            const size_t segment_size = m_udp_segment_size;
+            bool gso = false;
+#if HL_NET_HAS_UDP_GSO
+            gso = segment_size && utils::set_udp_segment_size(context.socket.native_handle(), segment_size);
+#endif
+            if (segment_size && !gso)
+            {
+                HL_NET_LOG_WARN("UDP_SEGMENT is not supported, the segmented sends are split by: {}", get_alias());
+            }
+            context.send_queue->set_segmentation(segment_size, gso);
+            context.stateless = m_stateless;
+
+            if (m_udp_gro)
+            {
+#if HL_NET_HAS_UDP_GSO && HL_NET_HAS_UDP_MMSG
+                context.gro = utils::set_udp_gro(context.socket.native_handle(), true);
+                context.control_size += context.gro ? utils::UDP_GRO_CONTROL_SIZE : 0;
+#endif
+                if (!context.gro)
+                {
+                    HL_NET_LOG_WARN("UDP_GRO is not supported, every datagram is received alone by: {}", get_alias());
+                }
+            }
+
+#if HL_NET_HAS_RXQ_OVFL
+            if (utils::set_rxq_ovfl(context.socket.native_handle(), true))
+            {
+                context.control_size += utils::RXQ_OVFL_CONTROL_SIZE;
+            }
+            else
+            {
+                HL_NET_LOG_WARN("SO_RXQ_OVFL is not supported, the receive drops are not counted by: {}", get_alias());
+            }
+#endif
+            return true;
+        }
+
+        send_result _send_to(const boost::asio::ip::udp::endpoint &endpoint, udp_send_queue::request request)
+        {
+            socket_context_t &context = *m_sockets[udp_peer_key(endpoint).hash() % m_sockets.size()];
+            if (!utils::udp_segmentable(request.size, context.send_queue->segment_size()))
+            {
+                HL_NET_LOG_ERROR("Cannot send {} bytes in segments of {} bytes to: {}", request.size, context.send_queue->segment_size(), utils::endpoint_to_string(endpoint));
+                connection_t connection(nullptr);
+                callbacks_register().on_send_error(connection, boost::system::error_code(boost::asio::error::message_size), 0);
+                return false;
+            }
+
+            HL_NET_LOG_DEBUG("Sending {} bytes to: {} from server: {}", request.size, utils::endpoint_to_string(endpoint), get_alias());
+            request.endpoint = endpoint;
+            context.send_queue->push(std::move(request));
+            return true;
+        }
+
+    protected:
+        // "address:port" as given by get_endpoint_id(), parsed back to a peer key
+        client_id_t _find_id(const std::string &endpoint_id) const override final
+        {
+            const size_t separator = endpoint_id.rfind(':');
+            if (separator == std::string::npos)
+            {
+                return INVALID_CLIENT_ID;
+            }
+            boost::system::error_code ec;
+            const boost::asio::ip::address address = boost::asio::ip::make_address(endpoint_id.substr(0, separator), ec);
+            char *end = nullptr;
+            const unsigned long port = std::strtoul(endpoint_id.c_str() + separator + 1, &end, 10);
+            if (ec || *end || end == endpoint_id.c_str() + separator + 1 || port > MAX_PORT)
+            {
+                return INVALID_CLIENT_ID;
+            }
+
+            const udp_peer_key key(boost::asio::ip::udp::endpoint(address, static_cast<port_t>(port)));
+            std::lock_guard<std::mutex> lock(m_endpoint_ids_mutex);
+            const client_id_t *found = m_endpoint_ids.find(key);
+            return found ? *found : INVALID_CLIENT_ID;
+        }
+
+        void _on_unset_connection(const connection_t &connection) override final
+        {
+            const shared_udp_connection_t udp_connection = boost::static_pointer_cast<udp_connection_t>(connection);
+            {
+                std::lock_guard<std::mutex> lock(m_endpoint_ids_mutex);
+                m_endpoint_ids.erase(udp_connection->peer_key(), udp_connection->get_id());
+            }
+
+            for (const socket_context_t::shared_t &context : m_sockets)
+            {
+                if (&context->socket != &udp_connection->socket())
+                {
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(context->peers_mutex);
+                context->peers.erase(udp_connection->peer_key(), connection);
+                return;
+            }
+        }
+
+    private:
         udp_server_unwrapped()
             : base_abstract_server_unwrapped()
-            , m_socket(_io_service())
-            , m_endpoint()
-            , m_receive_buffer(make_shared_buffer())
+            , m_sockets()
+            , m_endpoint_ids_mutex()
+            , m_endpoint_ids()
+            , m_udp_segment_size(0)
+            , m_udp_gro(false)
+            , m_stateless(false)
+            , m_udp_receives(HL_NET_DEFAULT_UDP_SERVER_RECEIVES)
         {
             HL_NET_LOG_TRACE("Creating udp_server_unwrapped: {}", get_alias());
         }
@@ -132,8 +542,125 @@ namespace net
             stop();
             HL_NET_LOG_TRACE("Destroyed udp_server_unwrapped: {}", get_alias());
         }
-    
+
     public:
+        // must be set before start(): a send bigger than `segment_size` goes out as datagrams of that size (the last
+        // one shorter), written by the kernel with a single UDP_SEGMENT send when it supports it. 0 disables it.
+        bool set_udp_segment_size(const size_t segment_size)
+        {
+            if (segment_size > HL_NET_UDP_MAX_PAYLOAD)
+            {
+                HL_NET_LOG_ERROR("Invalid udp segment size: {} for: {}", segment_size, get_alias());
+                return false;
+            }
+            m_udp_segment_size = segment_size;
+            return true;
+        }
+
+        size_t get_udp_segment_size() const
+        {
+            return m_udp_segment_size;
+        }
+
+        // must be set before start(): the kernel may coalesce the datagrams of a peer in one receive (UDP_GRO), they
+        // are split again before on_receive. Their buffers are then always copies, whatever the receive mode.
+        void set_udp_gro(const bool enabled)
+        {
+            m_udp_gro = enabled;
+        }
+
+        bool get_udp_gro() const
+        {
+            return m_udp_gro;
+        }
+
+        // receives kept in flight on each socket, 0 means one per io thread, applied on the next start(). With more
+        // than one, a slow callback holds a single receive while the others keep taking the datagrams of the socket
+        // on the other io threads, so the datagrams of a peer may be dispatched concurrently and out of order.
+        void set_udp_receives(const size_t count)
+        {
+            m_udp_receives = count;
+        }
+
+        size_t get_udp_receives() const
+        {
+            const size_t count = m_udp_receives;
+            return count ? count : get_io_threads();
+        }
+
+        // datagrams the sockets dropped since start() because their receive buffer was full, 0 without SO_RXQ_OVFL
+        // (linux with the recvmmsg receive). Counted once a receive reports them, not as they happen.
+        std::uint64_t get_udp_receive_drops() const
+        {
+            std::uint64_t drops = 0;
+            for (const socket_context_t::shared_t &context : m_sockets)
+            {
+                drops += context->drops;
+            }
+            return drops;
+        }
+
+        // must be set before start(): every datagram is given to on_datagram with its sender, no connection is made
+        // nor kept for the peers (no on_connection, on_receive or client id), the replies go out with send_to().
+        void set_stateless(const bool enabled)
+        {
+            m_stateless = enabled;
+        }
+
+        bool get_stateless() const
+        {
+            return m_stateless;
+        }
+
+        // Sends a datagram to the endpoint without any connection, in stateless mode or not. The datagrams to a same
+        // endpoint go out on the same socket, in order. Errors after the send was queued only reach the completion.
+        send_result send_to(const boost::asio::ip::udp::endpoint &endpoint, const shared_buffer_t &buffer, const size_t &size, const send_completion_t &completion = nullptr)
+        {
+            connection_t connection(nullptr);
+            if (!healthy() || m_sockets.empty())
+            {
+                HL_NET_LOG_ERROR("Cannot send data from a non-healthy server: {}", get_alias());
+                callbacks_register().on_send_error(connection, boost::system::error_code(boost::asio::error::not_connected), 0);
+                return false;
+            }
+            else if (!size || !buffer || size > buffer->size())
+            {
+                HL_NET_LOG_ERROR("Cannot send {} bytes from a buffer of {} bytes to: {}", size, buffer ? buffer->size() : 0, utils::endpoint_to_string(endpoint));
+                callbacks_register().on_send_error(connection, boost::system::error_code(boost::asio::error::invalid_argument), 0);
+                return false;
+            }
+
+            udp_send_queue::request request;
+            request.buffer = buffer;
+            request.size = size;
+            request.completion = completion;
+            return _send_to(endpoint, std::move(request));
+        }
+
+        send_result send_to(const boost::asio::ip::udp::endpoint &endpoint, const shared_buffer_sequence_t &buffers)
+        {
+            connection_t connection(nullptr);
+            if (!healthy() || m_sockets.empty())
+            {
+                HL_NET_LOG_ERROR("Cannot send data from a non-healthy server: {}", get_alias());
+                callbacks_register().on_send_error(connection, boost::system::error_code(boost::asio::error::not_connected), 0);
+                return false;
+            }
+
+            const shared_buffer_sequence_holder_t sequence = make_shared_buffer_sequence_holder(buffers);
+            if (!sequence || !sequence->size)
+            {
+                HL_NET_LOG_ERROR("Cannot send an empty buffer sequence to: {}", utils::endpoint_to_string(endpoint));
+                callbacks_register().on_send_error(connection, boost::system::error_code(boost::asio::error::invalid_argument), 0);
+                return false;
+            }
+
+            udp_send_queue::request request;
+            request.sequence = sequence;
+            request.size = sequence->size;
+            return _send_to(endpoint, std::move(request));
+        }
+
         bool start(const std::string &port) override final
         {
             {
@@ -157,19 +684,30 @@ namespace net
                 }
 
                 boost::asio::ip::udp::endpoint const endpoint(boost::asio::ip::udp::v4(), vport);
-                boost::system::error_code ec;
 
-                m_socket.open(boost::asio::ip::udp::v4(), ec);
-                if (ec)
+                size_t sockets = _unsafe_prepare_io_shards();
+#if !HL_NET_HAS_REUSE_PORT
+                if (sockets > 1)
                 {
-                    HL_NET_LOG_ERROR("Failed to open socket: {} for {}", ec.message(), get_alias());
-                    return false;
+                    HL_NET_LOG_WARN("SO_REUSEPORT is not supported, a single socket is used by: {}", get_alias());
+                    sockets = 1;
                 }
-                m_socket.bind(endpoint, ec);
-                if (ec)
+#endif
+
+                const size_t receives = get_udp_receives();
+                m_sockets.clear();
+                for (size_t shard = 0; shard < sockets; ++shard)
                 {
-                    HL_NET_LOG_ERROR("Failed to bind socket for: {}", get_alias());
-                    return false;
+                    m_sockets.push_back(boost::make_shared<socket_context_t>(_io_service(shard)));
+                    if (!_open_socket(*m_sockets.back(), endpoint, sockets > 1))
+                    {
+                        m_sockets.clear();
+                        return false;
+                    }
+                    for (size_t receive = 0; receive < receives; ++receive)
+                    {
+                        _add_receive(*m_sockets.back());
+                    }
                 }
 
                 _unsafe_start();
@@ -177,25 +715,51 @@ namespace net
                 callbacks_register().on_start_success();
             }
 
-            _receive_async();
-            HL_NET_LOG_DEBUG("Started server: {} on 0.0.0.0:{}", get_alias(), port);
+            for (const socket_context_t::shared_t &context : m_sockets)
+            {
+                for (const udp_receive_slot::shared_t &slot : context->receives)
+                {
+#if HL_NET_HAS_UDP_MMSG
+                    _wait_or_idle(context, slot);
+#else
+                    _receive_async(context, slot);
+#endif
+                }
+            }
+            HL_NET_LOG_DEBUG("Started server: {} on 0.0.0.0:{} with {} sockets", get_alias(), port, m_sockets.size());
             return true;
         }
 
         bool stop() override final
         {
-            std::lock_guard<std::mutex> lock_flow(m_mutex_api_control_flow);
-            HL_NET_LOG_DEBUG("Stopping server: {}", get_alias());
-
-            if (is_running() == false)
             {
-                HL_NET_LOG_WARN("Server already stopped: {}", get_alias());
-                callbacks_register().on_stop_error(boost::system::error_code(boost::asio::error::operation_aborted));
-                return false;
+                std::lock_guard<std::mutex> lock_flow(m_mutex_api_control_flow);
+                HL_NET_LOG_DEBUG("Stopping server: {}", get_alias());
+
+                if (is_running() == false)
+                {
+                    HL_NET_LOG_WARN("Server already stopped: {}", get_alias());
+                    callbacks_register().on_stop_error(boost::system::error_code(boost::asio::error::operation_aborted));
+                    return false;
+                }
+
+                set_run_status(false);
+                for (const socket_context_t::shared_t &context : m_sockets)
+                {
+                    std::lock_guard<std::mutex> lock_socket(context->control_flow_mutex);
+                    context->socket.close();
+                }
             }
 
-            m_socket.close();
+            // joins the io threads, whose handlers may be waiting on m_mutex_api_control_flow
             _unsafe_stop();
+            for (const socket_context_t::shared_t &context : m_sockets)
+            {
+                context->peers.clear();
+                context->send_queue->clear();
+            }
+            std::lock_guard<std::mutex> lock(m_endpoint_ids_mutex);
+            m_endpoint_ids.clear();
             HL_NET_LOG_DEBUG("Stopped server: {}", get_alias());
             return true;
         }
@@ -5,9 +5,18 @@ Copyright: (C) 2024 Mattis DALLEAU
 
 #pragma once
 
+#include <cstdint>
+#include <cstring>
 #include <string>
+#include <boost/asio/detail/socket_option.hpp>
+#include <boost/asio/socket_base.hpp>
+#include "HelNet/base.hpp"
 #include "HelNet/logger.hpp" // Includes the fmt::format function
 
+#if defined(__linux__)
+    #include <sys/socket.h>
+#endif
+
 namespace hl
 {
 namespace net
@@ -20,6 +29,51 @@ namespace utils
         return endpoint.address().to_string() + ":" + std::to_string(endpoint.port());
     }
 
+#if defined(SO_REUSEPORT)
+    #define HL_NET_HAS_REUSE_PORT 1
+    // lets several sockets bind the same port, the kernel balances the connections/datagrams between them
+    using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#else
+    #define HL_NET_HAS_REUSE_PORT 0
+#endif
+
+#if defined(__linux__) && !defined(HL_NET_UDP_MMSG_DISABLED)
+    // recvmmsg/sendmmsg move a batch of datagrams with a single system call
+    #define HL_NET_HAS_UDP_MMSG 1
+#else
+    #define HL_NET_HAS_UDP_MMSG 0
+#endif
+
+#if HL_NET_HAS_UDP_MMSG && defined(SO_RXQ_OVFL)
+    // the receives carry the count of datagrams the socket dropped, once it dropped any
+    #define HL_NET_HAS_RXQ_OVFL 1
+
+    // room for the SO_RXQ_OVFL control message of a receive
+    HL_NET_STATIC_CONSTEXPR size_t RXQ_OVFL_CONTROL_SIZE = CMSG_SPACE(sizeof(std::uint32_t));
+
+    static inline bool set_rxq_ovfl(const int fd, const bool enabled)
+    {
+        const int value = enabled ? 1 : 0;
+        return ::setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &value, sizeof(value)) == 0;
+    }
+
+    // false when the receive does not carry the counter, the socket did not drop anything yet
+    static inline bool rxq_ovfl_drops(msghdr &message, std::uint32_t &drops)
+    {
+        for (cmsghdr *control = CMSG_FIRSTHDR(&message); control; control = CMSG_NXTHDR(&message, control))
+        {
+            if (control->cmsg_level == SOL_SOCKET && control->cmsg_type == SO_RXQ_OVFL)
+            {
+                std::memcpy(&drops, CMSG_DATA(control), sizeof(drops));
+                return true;
+            }
+        }
+        return false;
+    }
+#else
+    #define HL_NET_HAS_RXQ_OVFL 0
+#endif
+
     template<typename K, typename V>
     class back_and_forth_unordered_map
     {
@@ -21,11 +21,19 @@ namespace net
 
         plugins::plugin_manager<plugins::server_plugin> m_plugins;
 
+        // state of wait_for_event(), only used by the thread waiting on it
+        event_notifier::generation_t m_seen_events;
+        std::chrono::milliseconds m_update_interval;
+        std::chrono::steady_clock::time_point m_next_update;
+
     public:
         server_wrapper()
             : m_shared_server(boost::static_pointer_cast<base_abstract_server_unwrapped>(Protocol::make()))
             , m_server(*boost::dynamic_pointer_cast<Protocol>(this->m_shared_server))
             , m_plugins()
+            , m_seen_events(0)
+            , m_update_interval(HL_NET_DEFAULT_UPDATE_INTERVAL_MS)
+            , m_next_update()
         {
             HL_NET_LOG_DEBUG("Creating server wrapper for server: {}", m_server.get_alias());
 
@@ -34,25 +42,27 @@ namespace net
 HL_NET_DIAGNOSTIC_PUSH()
 HL_NET_DIAGNOSTIC_UNUSED_PARAMETER_IGNORED()
             server_callbacks server_callbacks;
-            server_callbacks.on_start_success_callback = HL_NET_SERVER_ON_START(server) { HL_NET_LOG_INFO("Server started: {}", server->get_alias()); };
+            server_callbacks.on_start_success_callback = HL_NET_SERVER_ON_START(server) { HL_NET_LOG_INFO("Server started: {}", server ? server->get_alias() : "nullserver"); };
             server_callbacks.on_stop_success_callback = HL_NET_SERVER_ON_STOP() { HL_NET_LOG_INFO("Server stopped: {}"); };
             server_callbacks.on_stop_error_callback = HL_NET_SERVER_ON_STOP_ERROR(ec) { HL_NET_LOG_ERROR("Server stop error: {}", ec.message()); };
-            server_callbacks.on_connection_callback = HL_NET_SERVER_ON_CONNECTION(server, client) { HL_NET_LOG_INFO("Server accepted connection: {} - {}", server->get_alias(), client->get_alias()); };
+            server_callbacks.on_connection_callback = HL_NET_SERVER_ON_CONNECTION(server, client) { HL_NET_LOG_INFO("Server accepted connection: {} - {}", server ? server->get_alias() : "nullserver", client ? client->get_alias() : "nullclient"); };
             server_callbacks.on_connection_error_callback = HL_NET_SERVER_ON_CONNECTION_ERROR(server, ec) {
                 HL_NET_LOG_ERROR("Server connection error: {} - {}", server ? server->get_alias() : "nullserver", ec.message());
             };
-            server_callbacks.on_disconnection_callback = HL_NET_SERVER_ON_DISCONNECTION(server, client_id) { HL_NET_LOG_INFO("Server disconnected: {} - {}", server->get_alias(), client_id); };
+            server_callbacks.on_disconnection_callback = HL_NET_SERVER_ON_DISCONNECTION(server, client_id) { HL_NET_LOG_INFO("Server disconnected: {} - {}", server ? server->get_alias() : "nullserver", client_id); };
             server_callbacks.on_disconnection_error_callback = HL_NET_SERVER_ON_DISCONNECTION_ERROR(server, ec) {
                 HL_NET_LOG_ERROR("Server disconnection error: {} - {}", server ? server->get_alias() : "nullserver", ec.message());
             };
-            server_callbacks.on_sent_callback = HL_NET_SERVER_ON_SENT(server, client, sent_bytes) { HL_NET_LOG_INFO("Server sent: {} - {} - {}", server->get_alias(), client->get_alias(), sent_bytes); };
+            server_callbacks.on_sent_callback = HL_NET_SERVER_ON_SENT(server, client, sent_bytes) { HL_NET_LOG_INFO("Server sent: {} - {} - {}", server ? server->get_alias() : "nullserver", client ? client->get_alias() : "nullclient", sent_bytes); };
             server_callbacks.on_send_error_callback = HL_NET_SERVER_ON_SEND_ERROR(server, client, ec, sent_bytes) {
                 HL_NET_LOG_ERROR("Server send error: {} - {} - {} - {}", server ? server->get_alias() : "nullserver", client ? client->get_alias() : "nullclient", ec.message(), sent_bytes);
             };
-            server_callbacks.on_receive_callback = HL_NET_SERVER_ON_RECEIVE(server, client, buffer_copy, recv_bytes) { HL_NET_LOG_INFO("Server received: {} - {} - {}", server->get_alias(), client->get_alias(), recv_bytes); };
+            server_callbacks.on_writable_callback = HL_NET_SERVER_ON_WRITABLE(server, client) { HL_NET_LOG_INFO("Server can send again: {} - {}", server ? server->get_alias() : "nullserver", client ? client->get_alias() : "nullclient"); };
+            server_callbacks.on_receive_callback = HL_NET_SERVER_ON_RECEIVE(server, client, buffer_copy, recv_bytes) { HL_NET_LOG_INFO("Server received: {} - {} - {}", server ? server->get_alias() : "nullserver", client ? client->get_alias() : "nullclient", recv_bytes); };
             server_callbacks.on_receive_error_callback = HL_NET_SERVER_ON_RECEIVE_ERROR(server, client, buffer_copy, ec, recv_bytes) {
                 HL_NET_LOG_ERROR("Server receive error: {} - {} - {} - {}", server ? server->get_alias() : "nullserver", client ? client->get_alias() : "nullclient", ec.message(), recv_bytes);
             };
+            server_callbacks.on_datagram_callback = HL_NET_SERVER_ON_DATAGRAM(server, sender, buffer_copy, recv_bytes) { HL_NET_LOG_INFO("Server received datagram: {} - {} - {}", server ? server->get_alias() : "nullserver", utils::endpoint_to_string(sender), recv_bytes); };
 HL_NET_DIAGNOSTIC_POP()
 
             m_server.callbacks_register().add_layer(DEFAULT_REGISTER_LAYER, server_callbacks);
@@ -79,6 +89,81 @@ HL_NET_DIAGNOSTIC_POP()
             m_server.set_alias(alias);
         }
 
+        void set_io_threads(const size_t count)
+        {
+            m_server.set_io_threads(count);
+        }
+
+        size_t get_io_threads() const
+        {
+            return m_server.get_io_threads();
+        }
+
+        void set_io_shards(const size_t count)
+        {
+            m_server.set_io_shards(count);
+        }
+
+        size_t get_io_shards() const
+        {
+            return m_server.get_io_shards();
+        }
+
+        void set_receive_mode(const receive_mode mode)
+        {
+            m_server.set_receive_mode(mode);
+        }
+
+        void set_receive_buffer_provider(const buffer_provider_t &provider)
+        {
+            m_server.set_receive_buffer_provider(provider);
+        }
+
+        void set_receive_backlog(const size_t high, const size_t low)
+        {
+            m_server.set_receive_backlog(high, low);
+        }
+
+        void set_sent_notification(const sent_notification notification)
+        {
+            m_server.set_sent_notification(notification);
+        }
+
+        void set_send_watermarks(const size_t high, const size_t low)
+        {
+            m_server.set_send_watermarks(high, low);
+        }
+
+        // udp only
+        bool set_udp_segment_size(const size_t segment_size)
+        {
+            return m_server.set_udp_segment_size(segment_size);
+        }
+
+        // udp only
+        void set_udp_gro(const bool enabled)
+        {
+            m_server.set_udp_gro(enabled);
+        }
+
+        // udp only
+        void set_stateless(const bool enabled)
+        {
+            m_server.set_stateless(enabled);
+        }
+
+        // udp only
+        void set_udp_receives(const size_t count)
+        {
+            m_server.set_udp_receives(count);
+        }
+
+        // udp only
+        std::uint64_t get_udp_receive_drops() const
+        {
+            return m_server.get_udp_receive_drops();
+        }
+
         bool start(const std::string &port)
         {
             return m_server.start(port);
@@ -89,28 +174,66 @@ HL_NET_DIAGNOSTIC_POP()
             return m_server.stop();
         }
 
-        bool send(const client_id_t& client_id, const shared_buffer_t &buffer, const size_t &size)
+        send_result send(const client_id_t& client_id, const shared_buffer_t &buffer, const size_t &size)
         {
             return m_server.send(client_id, buffer, size);
         }
 
+        send_result send(const client_id_t& client_id, const shared_buffer_sequence_t &buffers)
+        {
+            return m_server.send(client_id, buffers);
+        }
+
+        // udp only
+        send_result send_to(const boost::asio::ip::udp::endpoint &endpoint, const shared_buffer_t &buffer, const size_t &size, const send_completion_t &completion = nullptr)
+        {
+            return m_server.send_to(endpoint, buffer, size, completion);
+        }
+
+        // udp only
+        send_result send_to(const boost::asio::ip::udp::endpoint &endpoint, const shared_buffer_sequence_t &buffers)
+        {
+            return m_server.send_to(endpoint, buffers);
+        }
+
+        size_t broadcast(const shared_buffer_t &buffer, const size_t &size, const broadcast_completion_t &completion = nullptr)
+        {
+            return m_server.broadcast(buffer, size, completion);
+        }
+
+        template<typename ClientIdRange>
+        size_t send_to_many(const ClientIdRange &client_ids, const shared_buffer_t &buffer, const size_t &size, const broadcast_completion_t &completion = nullptr)
+        {
+            return m_server.send_to_many(client_ids, buffer, size, completion);
+        }
+
+        size_t send_to_many(const std::initializer_list<client_id_t> &client_ids, const shared_buffer_t &buffer, const size_t &size, const broadcast_completion_t &completion = nullptr)
+        {
+            return m_server.send_to_many(client_ids, buffer, size, completion);
+        }
+
+        connection_handle get_handle(const client_id_t& client_id) const
+        {
+            return m_server.get_handle(client_id);
+        }
+
         bool disconnect(const client_id_t& client_id)
         {
             return m_server.disconnect(client_id);
         }
 
-        bool send_bytes(const client_id_t& client_id, const void *data, const size_t &size)
+        send_result send_bytes(const client_id_t& client_id, const void *data, const size_t &size)
         {
             return m_server.send_bytes(client_id, data, size);
         }
 
-        bool send_string(const client_id_t& client_id, const std::string &str)
+        send_result send_string(const client_id_t& client_id, const std::string &str)
         {
             return m_server.send_string(client_id, str);
         }
 
         template<typename T>
-        bool send_bytes(const client_id_t& client_id, const std::vector<T> &data)
+        send_result send_bytes(const client_id_t& client_id, const std::vector<T> &data)
         {
             return m_server.send_bytes(client_id, data);
         }
@@ -125,9 +248,10 @@ HL_NET_DIAGNOSTIC_POP()
             return m_server.should_exit();
         }
 
-        bool request_stop()
+        // wakes up wait_for_event(), which then returns false
+        void request_stop()
         {
-            return m_server.request_stop();
+            m_server.request_stop();
         }
 
         template<class Plugin, class... Args>
@@ -147,6 +271,50 @@ HL_NET_DIAGNOSTIC_POP()
             this->m_plugins.update(this->m_shared_server);
             return this->healthy();
         }
+
+        // period of the plugins updates done by wait_for_event()
+        void set_update_interval(const std::chrono::milliseconds &interval)
+        {
+            m_update_interval = interval;
+        }
+
+        // runs the task on the thread waiting in wait_for_event()
+        void post(const event_notifier::task_t &task)
+        {
+            m_server.events().post(task);
+        }
+
+        // Blocks until the health of the server changes, a task is posted or the plugins update is due (or timeout),
+        // then runs the posted tasks and the due plugins update. Returns healthy() like update().
+        bool wait_for_event(const std::chrono::milliseconds &timeout = std::chrono::milliseconds(HL_NET_DEFAULT_UPDATE_INTERVAL_MS))
+        {
+            std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+            if (!m_plugins.empty() && m_next_update < deadline)
+            {
+                deadline = m_next_update;
+            }
+
+            for (const event_notifier::task_t &task : m_server.events().wait_until(deadline, m_seen_events))
+            {
+                task();
+            }
+
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (!m_plugins.empty() && now >= m_next_update)
+            {
+                m_plugins.update(this->m_shared_server);
+                m_next_update = now + m_update_interval;
+            }
+            return this->healthy();
+        }
+
+        // replaces the `while (server.update()) {}` loop without spinning, returns once the server is not healthy
+        void run_until_stopped()
+        {
+            while (wait_for_event())
+            {
+            }
+        }
     };
 }
 }
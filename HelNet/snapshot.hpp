@@ -0,0 +1,125 @@
+/*
+This code is licensed under the GNU GPL v3.
+Copyright: (C) 2024 Mattis DALLEAU
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <hl/silva/collections/meta.hpp>
+
+namespace hl
+{
+namespace net
+{
+    // Immutable value read without lock, the writers build a new one and swap it in with unsafe_replace().
+    // A count of readers keeps the replaced values alive while they may still be read: they are freed by the
+    // last reader leaving, by the next replace made while nobody reads, or with the snapshot.
+    template<typename T>
+    class shared_snapshot final : public hl::silva::collections::meta::NonCopyMoveable
+    {
+    public:
+        using value_type = T;
+
+        // pins the value it read until it is destroyed
+        class reader final
+        {
+        private:
+            shared_snapshot &m_snapshot;
+            const value_type *m_value;
+
+        public:
+            explicit reader(shared_snapshot &snapshot)
+                : m_snapshot(snapshot)
+                , m_value(nullptr)
+            {
+                m_snapshot.m_readers.fetch_add(1);
+                m_value = m_snapshot.m_current.load();
+            }
+
+            reader(const reader &) = delete;
+            reader& operator=(const reader &) = delete;
+
+            ~reader()
+            {
+                if (m_snapshot.m_readers.fetch_sub(1) == 1 && m_snapshot.m_has_retired.load())
+                {
+                    m_snapshot._try_release_retired();
+                }
+            }
+
+            const value_type& operator*() const
+            {
+                return *m_value;
+            }
+
+            const value_type* operator->() const
+            {
+                return m_value;
+            }
+        };
+
+    private:
+        std::unique_ptr<const value_type> m_owned;
+        std::atomic<const value_type*> m_current;
+        std::atomic<size_t> m_readers;
+
+        std::mutex m_retired_mutex;
+        std::vector<std::unique_ptr<const value_type>> m_retired;
+        std::atomic_bool m_has_retired;
+
+        // never blocks a reader, a concurrent replace frees them itself when possible
+        void _try_release_retired()
+        {
+            std::unique_lock<std::mutex> lock(m_retired_mutex, std::try_to_lock);
+            if (lock.owns_lock() && m_readers.load() == 0)
+            {
+                m_retired.clear();
+                m_has_retired = false;
+            }
+        }
+
+    public:
+        shared_snapshot()
+            : m_owned(new value_type())
+            , m_current(m_owned.get())
+            , m_readers(0)
+            , m_retired_mutex()
+            , m_retired()
+            , m_has_retired(false)
+        {}
+
+        ~shared_snapshot() = default;
+
+        // the current value, only for the writers (that serialize their replaces)
+        const value_type& unsafe_get() const
+        {
+            return *m_owned;
+        }
+
+        // the writers must serialize their calls to keep the read-copy-replace consistent
+        void unsafe_replace(std::unique_ptr<const value_type> value)
+        {
+            std::lock_guard<std::mutex> lock(m_retired_mutex);
+            m_current.store(value.get());
+            m_retired.push_back(std::move(m_owned));
+            m_owned = std::move(value);
+
+            // a reader starting from now reads the new value, none is left on the old ones once there are no readers
+            if (m_readers.load() == 0)
+            {
+                m_retired.clear();
+                m_has_retired = false;
+            }
+            else
+            {
+                m_has_retired = true;
+            }
+        }
+    };
+}
+}
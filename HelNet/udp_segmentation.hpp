@@ -0,0 +1,114 @@
+/*
+This code is licensed under the GNU GPL v3.
+Copyright: (C) 2024 Mattis DALLEAU
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+
+#include <boost/asio/buffer.hpp>
+
+#include "HelNet/base.hpp"
+
+#if defined(__linux__)
+    #include <netinet/in.h>
+    #include <netinet/udp.h>
+    #include <sys/socket.h>
+#endif
+
+#if defined(__linux__) && defined(UDP_SEGMENT) && defined(UDP_GRO) && !defined(HL_NET_UDP_GSO_DISABLED)
+    // UDP_SEGMENT lets one send carry many datagrams, UDP_GRO lets one receive hold many coalesced datagrams
+    #define HL_NET_HAS_UDP_GSO 1
+#else
+    #define HL_NET_HAS_UDP_GSO 0
+#endif
+
+namespace hl
+{
+namespace net
+{
+namespace utils
+{
+    // datagrams a send of `size` bytes goes out as, 1 when it is not segmented
+    static inline size_t udp_segment_count(const size_t size, const size_t segment_size)
+    {
+        return segment_size && size > segment_size ? (size + segment_size - 1) / segment_size : 1;
+    }
+
+    // the same limits apply whether the kernel or the library splits the send
+    static inline bool udp_segmentable(const size_t size, const size_t segment_size)
+    {
+        return udp_segment_count(size, segment_size) == 1 || (udp_segment_count(size, segment_size) <= HL_NET_UDP_MAX_SEGMENTS && size <= HL_NET_UDP_MAX_PAYLOAD);
+    }
+
+    // calls on_view(data, size) for the pieces of the buffer sequence covering [offset, offset + length)
+    template<typename ConstBufferSequence, typename OnView>
+    static inline void for_each_view_in_range(const ConstBufferSequence &views, size_t offset, size_t length, OnView on_view)
+    {
+        for (const boost::asio::const_buffer &view : views)
+        {
+            if (!length)
+            {
+                return;
+            }
+            if (offset >= view.size())
+            {
+                offset -= view.size();
+                continue;
+            }
+            const size_t bytes = std::min(view.size() - offset, length);
+            on_view(static_cast<const byte *>(view.data()) + offset, bytes);
+            offset = 0;
+            length -= bytes;
+        }
+    }
+
+    // calls on_segment(offset, length) for each datagram of a receive coalesced with `segment_size` (0 when it is not)
+    template<typename OnSegment>
+    static inline void for_each_udp_segment(const size_t size, const size_t segment_size, OnSegment on_segment)
+    {
+        const size_t step = segment_size ? segment_size : size;
+        for (size_t offset = 0; offset < size; offset += step)
+        {
+            on_segment(offset, std::min(step, size - offset));
+        }
+    }
+
+#if HL_NET_HAS_UDP_GSO
+    // room for the UDP_GRO control message of a receive
+    HL_NET_STATIC_CONSTEXPR size_t UDP_GRO_CONTROL_SIZE = CMSG_SPACE(sizeof(int));
+
+    // the sends of the socket bigger than `segment_size` are split by the kernel (0 stops it), false before linux 4.18
+    static inline bool set_udp_segment_size(const int fd, const size_t segment_size)
+    {
+        const int value = static_cast<int>(segment_size);
+        return ::setsockopt(fd, SOL_UDP, UDP_SEGMENT, &value, sizeof(value)) == 0;
+    }
+
+    // the datagrams of a peer may then be coalesced in one receive, false before linux 5.0
+    static inline bool set_udp_gro(const int fd, const bool enabled)
+    {
+        const int value = enabled ? 1 : 0;
+        return ::setsockopt(fd, SOL_UDP, UDP_GRO, &value, sizeof(value)) == 0;
+    }
+
+    // size of the datagrams coalesced in a receive, 0 when it holds a single one
+    static inline size_t udp_gro_segment_size(msghdr &message)
+    {
+        for (cmsghdr *control = CMSG_FIRSTHDR(&message); control; control = CMSG_NXTHDR(&message, control))
+        {
+            if (control->cmsg_level == SOL_UDP && control->cmsg_type == UDP_GRO)
+            {
+                int segment_size = 0;
+                std::memcpy(&segment_size, CMSG_DATA(control), sizeof(segment_size));
+                return segment_size > 0 ? static_cast<size_t>(segment_size) : 0;
+            }
+        }
+        return 0;
+    }
+#endif
+}
+}
+}
@@ -0,0 +1,24 @@
+#!/bin/bash
+# Builds the benchmarks given as arguments (all of bench/*.cpp by default) next to their source.
+# Usage: bench/build.sh [bench/dispatch.cpp ...]
+
+cd "$(dirname "$0")/.." || exit 1
+
+sources=("${@}")
+if [ ${#sources[@]} -eq 0 ]; then
+    sources=(bench/*.cpp)
+fi
+
+for source in "${sources[@]}"; do
+    g++ -std=c++2a \
+        -O2 \
+        \
+        -ISilvaCollections/ \
+        -I./ \
+        \
+        ${HL_NET_BENCH_FLAGS} \
+        \
+        "${source}" -o "${source%.cpp}.out" \
+        \
+        -lspdlog -lfmt -lpthread || exit 1
+done
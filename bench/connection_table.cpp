@@ -0,0 +1,181 @@
+#define HL_NET_LOG_LEVEL HL_NET_LOG_LEVEL_WARN
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include "HelNet.hpp"
+
+// The server connection table against one mutex + unordered_map (the design before it), 1024 connections:
+// - lookups by id with find() and apply() from 1 to 32 threads, then with a thread accepting and disconnecting meanwhile
+// - the cost of an accept + disconnection (insert + erase) with 1024 and 4096 live connections
+// Builds against every version of the table, apply() is reported as n/a on those without it.
+static const size_t CONNECTIONS = 1024;
+
+using connection_t = hl::net::connection_t;
+using client_id_t = hl::net::client_id_t;
+
+struct locked_map final {
+    std::mutex mutex;
+    std::unordered_map<client_id_t, connection_t> connections;
+
+    connection_t find(const client_id_t id)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto it = connections.find(id);
+        return it == connections.end() ? nullptr : it->second;
+    }
+};
+
+struct is_connection final {
+    bool operator()(hl::net::base_abstract_connection_unwrapped &) const
+    {
+        return true;
+    }
+};
+
+template<typename Table>
+static auto has_apply(int) -> decltype(std::declval<const Table &>().apply(client_id_t(), is_connection(), false), std::true_type());
+
+template<typename Table>
+static std::false_type has_apply(long);
+
+using table_has_apply = decltype(has_apply<hl::net::connection_table>(0));
+
+template<typename Table>
+static bool apply_lookup(const Table &table, const client_id_t id, std::true_type)
+{
+    return table.apply(id, is_connection(), false);
+}
+
+template<typename Table>
+static bool apply_lookup(const Table &, const client_id_t, std::false_type)
+{
+    return false;
+}
+
+template<typename Lookup>
+static double mlookups_per_second(const size_t threads, const std::vector<client_id_t> &ids, const Lookup &lookup)
+{
+    static const std::chrono::milliseconds DURATION(500);
+
+    std::atomic<bool> go(false), stop(false);
+    std::atomic<uint64_t> lookups(0), misses(0);
+    std::vector<std::thread> workers;
+
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            uint64_t done = 0, missed = 0;
+            size_t index = t;
+            while (!go) {}
+            while (!stop) {
+                for (int i = 0; i < 256; ++i) {
+                    missed += !lookup(ids[index++ % ids.size()]);
+                }
+                done += 256;
+            }
+            lookups += done;
+            misses += missed;
+        });
+    }
+    go = true;
+    std::this_thread::sleep_for(DURATION);
+    stop = true;
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    if (misses != 0) {
+        std::printf("  %lu lookups missed\n", static_cast<unsigned long>(misses.load()));
+    }
+    return static_cast<double>(lookups) / std::chrono::duration<double>(DURATION).count() / 1e6;
+}
+
+template<typename MakeConnection>
+static double insert_erase_us(const size_t live, const MakeConnection &make_connection)
+{
+    static const size_t ROUNDS = 20000;
+
+    hl::net::connection_table table;
+    for (size_t i = 0; i < live; ++i) {
+        table.insert(make_connection(), std::to_string(i));
+    }
+
+    const connection_t connection = make_connection();
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ROUNDS; ++i) {
+        table.erase(table.insert(connection, "accepted"));
+    }
+    const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+    table.clear();
+    return elapsed.count() / ROUNDS;
+}
+
+int main()
+{
+    boost::asio::io_service io_service;
+    hl::net::server_callback_register callbacks([]() { return hl::net::server_t(); });
+    const auto make_connection = [&]() {
+        return boost::static_pointer_cast<hl::net::base_abstract_connection_unwrapped>(
+            hl::net::tcp_connection_unwrapped::make(io_service, callbacks, []() {}, [](const client_id_t &) {}));
+    };
+
+    locked_map map;
+    hl::net::connection_table table;
+    std::vector<client_id_t> ids;
+    for (size_t i = 0; i < CONNECTIONS; ++i) {
+        const connection_t connection = make_connection();
+        ids.push_back(table.insert(connection, std::to_string(i)));
+        map.connections.emplace(ids.back(), connection);
+    }
+
+    std::printf("lookups, Mlookup/s\n");
+    for (const bool churn : {false, true}) {
+        std::atomic<bool> churn_stop(false);
+        std::thread churner;
+        if (churn) {
+            churner = std::thread([&]() {
+                while (!churn_stop) {
+                    const connection_t connection = make_connection();
+                    const client_id_t id = table.insert(connection, "churn");
+                    {
+                        std::lock_guard<std::mutex> lock(map.mutex);
+                        map.connections.emplace(id, connection);
+                    }
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                    table.erase(id);
+                    std::lock_guard<std::mutex> lock(map.mutex);
+                    map.connections.erase(id);
+                }
+            });
+        }
+
+        for (const size_t threads : {1, 2, 4, 8, 16, 32}) {
+            const double locked = mlookups_per_second(threads, ids, [&map](const client_id_t id) { return static_cast<bool>(map.find(id)); });
+            const double found = mlookups_per_second(threads, ids, [&table](const client_id_t id) { return static_cast<bool>(table.find(id)); });
+            std::printf("  churn=%d threads=%2zu: mutex+map find %6.1f, table find %6.1f, table apply ", churn, threads, locked, found);
+            if (table_has_apply::value) {
+                std::printf("%6.1f\n", mlookups_per_second(threads, ids, [&table](const client_id_t id) { return apply_lookup(table, id, table_has_apply()); }));
+            } else {
+                std::printf("   n/a\n");
+            }
+        }
+
+        churn_stop = true;
+        if (churner.joinable()) {
+            churner.join();
+        }
+    }
+
+    std::printf("insert + erase, us\n");
+    for (const size_t live : {CONNECTIONS, 4 * CONNECTIONS}) {
+        std::printf("  live=%4zu: table %.2f\n", live, insert_erase_us(live, make_connection));
+    }
+
+    table.clear();
+    return 0;
+}
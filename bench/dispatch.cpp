@@ -0,0 +1,57 @@
+#define HL_NET_LOG_LEVEL HL_NET_LOG_LEVEL_WARN
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include "HelNet.hpp"
+
+// Cost of a sync on_receive dispatch through 1, 4 and 16 layers, from 1 and 4 threads
+static thread_local size_t received_bytes = 0;
+
+static double dispatch_ns(const int layers, const int threads, const int calls)
+{
+    hl::net::server_callback_register callbacks([]() { return hl::net::server_t(); });
+
+    for (int i = 0; i < layers; ++i) {
+        const std::string layer = "layer" + std::to_string(i);
+        callbacks.add_layer(layer);
+        callbacks.set_on_receive([](hl::net::server_t, hl::net::connection_t, hl::net::shared_buffer_t, const size_t size) {
+            received_bytes += size;
+        }, layer);
+    }
+
+    const int calls_per_thread = calls / threads;
+    std::vector<std::thread> workers;
+    const auto start = std::chrono::steady_clock::now();
+
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&callbacks, calls_per_thread]() {
+            hl::net::connection_t connection;
+            hl::net::shared_buffer_t buffer;
+            for (int i = 0; i < calls_per_thread; ++i) {
+                callbacks.on_receive(connection, buffer, 3);
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (calls_per_thread * threads);
+}
+
+int main(int argc, char **argv)
+{
+    const int calls = argc > 1 ? std::atoi(argv[1]) : 2000000;
+
+    dispatch_ns(1, 1, calls); // warm up
+
+    for (const int threads : {1, 4}) {
+        for (const int layers : {1, 4, 16}) {
+            std::printf("threads=%d layers=%2d: %6.1f ns/dispatch\n", threads, layers, dispatch_ns(layers, threads, calls));
+        }
+    }
+    return 0;
+}
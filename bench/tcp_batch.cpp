@@ -0,0 +1,128 @@
+#define HL_NET_LOG_LEVEL HL_NET_LOG_LEVEL_WARN
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include "HelNet.hpp"
+
+// Numbered messages sent from 4 threads, then 3 big buffers, reach the client complete and in per-thread order;
+// counts the on_sent calls per message and per batch
+static const size_t THREADS = 4;
+static const uint32_t MESSAGES_PER_THREAD = 250;
+static const size_t MESSAGE_SIZE = 8;
+static const size_t BIG_BUFFERS = 3;
+static const size_t BIG_BUFFER_SIZE = 4 << 20;
+
+static bool check(const std::string &port, const hl::net::sent_notification notification)
+{
+    std::atomic<hl::net::client_id_t> id(hl::net::INVALID_CLIENT_ID);
+    std::atomic<size_t> sent_calls(0), sent_bytes(0);
+
+    hl::net::tcp_server server;
+    server.set_sent_notification(notification);
+    server.callbacks_register().set_on_connection([&id](hl::net::server_t, hl::net::connection_t client) {
+        id = client->get_id();
+    });
+    server.callbacks_register().set_on_sent([&](hl::net::server_t, hl::net::connection_t, const size_t size) {
+        sent_calls++;
+        sent_bytes += size;
+    });
+    if (server.start(port) == false) {
+        std::printf("failed to start the server on port %s\n", port.c_str());
+        return false;
+    }
+
+    std::mutex received_mutex;
+    std::vector<unsigned char> received;
+    hl::net::tcp_client client;
+    client.callbacks_register().set_on_receive([&](hl::net::client_t, hl::net::shared_buffer_t buffer, const size_t size) {
+        const unsigned char *data = reinterpret_cast<const unsigned char *>(buffer->data());
+        std::lock_guard<std::mutex> lock(received_mutex);
+        received.insert(received.end(), data, data + size);
+    });
+    client.connect("127.0.0.1", port);
+    while (id == hl::net::INVALID_CLIENT_ID) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    // each message holds the number of its thread then its index in that thread
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&server, &id, t]() {
+            for (uint32_t i = 0; i < MESSAGES_PER_THREAD; ++i) {
+                hl::net::shared_buffer_t message = hl::net::make_shared_buffer(MESSAGE_SIZE);
+                std::memcpy(message->data(), &t, 4);
+                std::memcpy(message->data() + 4, &i, 4);
+                server.send(id, message, MESSAGE_SIZE);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (size_t i = 0; i < BIG_BUFFERS; ++i) {
+        hl::net::shared_buffer_t buffer = hl::net::make_shared_buffer(BIG_BUFFER_SIZE);
+        std::memset(buffer->data(), 0xAB, BIG_BUFFER_SIZE);
+        server.send(id, buffer, BIG_BUFFER_SIZE);
+    }
+
+    const size_t small_bytes = THREADS * MESSAGES_PER_THREAD * MESSAGE_SIZE;
+    const size_t expected = small_bytes + BIG_BUFFERS * BIG_BUFFER_SIZE;
+    const auto start = std::chrono::steady_clock::now();
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(received_mutex);
+            if (received.size() >= expected) {
+                break;
+            }
+        }
+        if (std::chrono::steady_clock::now() - start > std::chrono::seconds(10)) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100)); // let the last on_sent run
+
+    bool in_order = true;
+    size_t received_bytes;
+    {
+        std::lock_guard<std::mutex> lock(received_mutex);
+        received_bytes = received.size();
+        std::vector<int64_t> last(THREADS, -1);
+        for (size_t offset = 0; offset + MESSAGE_SIZE <= std::min(small_bytes, received.size()); offset += MESSAGE_SIZE) {
+            uint32_t thread, index;
+            std::memcpy(&thread, &received[offset], 4);
+            std::memcpy(&index, &received[offset + 4], 4);
+            if (thread >= THREADS || index != last[thread] + 1) {
+                in_order = false;
+                break;
+            }
+            last[thread] = index;
+        }
+    }
+
+    client.disconnect();
+    server.stop();
+
+    std::printf("%s: received %zu/%zu bytes, in order: %s, on_sent called %zu times for %zu bytes\n",
+        notification == hl::net::sent_notification::per_batch ? "per batch" : "per message",
+        received_bytes, expected, in_order ? "yes" : "no", sent_calls.load(), sent_bytes.load());
+    return received_bytes == expected && in_order && sent_bytes == expected;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        std::printf("%s: <port>\n", argv[0]);
+        return 1;
+    }
+
+    bool ok = check(argv[1], hl::net::sent_notification::per_message);
+    ok = check(argv[1], hl::net::sent_notification::per_batch) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,131 @@
+#define HL_NET_LOG_LEVEL HL_NET_LOG_LEVEL_WARN
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include "HelNet.hpp"
+
+// Tcp echo throughput per count of server io threads: every client keeps a window of messages in flight and sends
+// the next ones as the echo comes back, until its payload went through the server and back
+static const size_t WINDOW_MESSAGES = 16;
+
+struct echo_client final {
+    hl::net::tcp_client client;
+    std::mutex mutex;
+    size_t sent;
+    size_t echoed;
+    size_t credit; // echoed bytes not yet answered by a send
+
+    echo_client()
+        : client()
+        , mutex()
+        , sent(0)
+        , echoed(0)
+        , credit(0)
+    {}
+};
+
+static bool echo(const std::string &port, const size_t io_threads, const size_t clients, const size_t bytes, const size_t message_size)
+{
+    hl::net::tcp_server server;
+    server.set_io_threads(io_threads);
+    server.callbacks_register().set_on_receive([](hl::net::server_t, hl::net::connection_t client, hl::net::shared_buffer_t buffer, const size_t size) {
+        client->send(buffer, size);
+    });
+    if (server.start(port) == false) {
+        std::printf("io_threads=%zu: failed to start the server on port %s\n", io_threads, port.c_str());
+        return false;
+    }
+
+    const hl::net::shared_buffer_t message = hl::net::make_shared_buffer(message_size);
+    std::atomic<size_t> done(0);
+    std::vector<std::unique_ptr<echo_client>> peers;
+    for (size_t i = 0; i < clients; ++i) {
+        peers.emplace_back(new echo_client);
+        echo_client &peer = *peers.back();
+        peer.client.callbacks_register().set_on_receive([&peer, &done, &message, bytes, message_size](hl::net::client_t, hl::net::shared_buffer_t, const size_t size) {
+            size_t to_send = 0;
+            {
+                std::lock_guard<std::mutex> lock(peer.mutex);
+                peer.echoed += size;
+                peer.credit += size;
+                while (peer.credit >= message_size && peer.sent + to_send < bytes) {
+                    peer.credit -= message_size;
+                    to_send += message_size;
+                }
+                peer.sent += to_send;
+                if (peer.echoed == bytes) {
+                    done++;
+                }
+            }
+            for (; to_send > 0; to_send -= message_size) {
+                peer.client.send(message, message_size);
+            }
+        });
+        if (peer.client.connect("127.0.0.1", port) == false) {
+            std::printf("io_threads=%zu: client %zu failed to connect\n", io_threads, i);
+            return false;
+        }
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    for (auto &peer : peers) {
+        size_t window;
+        {
+            std::lock_guard<std::mutex> lock(peer->mutex);
+            window = std::min(WINDOW_MESSAGES, bytes / message_size);
+            peer->sent = window * message_size;
+        }
+        for (size_t i = 0; i < window; ++i) {
+            peer->client.send(message, message_size);
+        }
+    }
+    while (done < clients && std::chrono::steady_clock::now() - start < std::chrono::seconds(60)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    for (auto &peer : peers) {
+        peer->client.disconnect();
+    }
+    server.stop();
+
+    const double total = static_cast<double>(clients * bytes);
+    if (done < clients) {
+        std::printf("io_threads=%zu: timed out, %zu/%zu clients done\n", io_threads, done.load(), clients);
+        return false;
+    }
+    std::printf("io_threads=%zu: %8.1f MB/s %9.0f msgs/s (%.2f s)\n", io_threads,
+        total / elapsed.count() / 1e6, total / static_cast<double>(message_size) / elapsed.count(), elapsed.count());
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        std::printf("%s: <port> [io threads = 1,2,4,8] [clients = 8] [bytes per client = 67108864] [message size = 65536]\n", argv[0]);
+        return 1;
+    }
+
+    const std::string port = argv[1];
+    std::vector<size_t> io_threads;
+    std::stringstream counts(argc > 2 ? argv[2] : "1,2,4,8");
+    for (std::string count; std::getline(counts, count, ',');) {
+        io_threads.push_back(std::strtoul(count.c_str(), nullptr, 10));
+    }
+    const size_t clients = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 8;
+    const size_t message_size = argc > 5 ? std::strtoul(argv[5], nullptr, 10) : 64 * 1024;
+    const size_t bytes = (argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 64 * 1024 * 1024) / message_size * message_size;
+
+    bool ok = true;
+    for (const size_t count : io_threads) {
+        ok = echo(port, count, clients, bytes, message_size) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+#define HL_NET_LOG_LEVEL HL_NET_LOG_LEVEL_WARN
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "HelNet.hpp"
+
+// Small server sends to 8 tcp clients from 1 to 32 producer threads: how fast send() returns (enqueue) and how fast
+// the clients get the bytes (delivered)
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        std::printf("%s: <port> [sends = 200000] [message size = 64]\n", argv[0]);
+        return 1;
+    }
+
+    static const size_t CLIENTS = 8;
+    const std::string port = argv[1];
+    const size_t sends = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200000;
+    const size_t message_size = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 64;
+
+    std::mutex ids_mutex;
+    std::vector<hl::net::client_id_t> ids;
+
+    hl::net::tcp_server server;
+    server.set_io_threads(2);
+    server.callbacks_register().set_on_connection([&](hl::net::server_t, hl::net::connection_t client) {
+        std::lock_guard<std::mutex> lock(ids_mutex);
+        ids.push_back(client->get_id());
+    });
+    server.callbacks_register().set_on_sent([](hl::net::server_t, hl::net::connection_t, const size_t) {});
+    if (server.start(port) == false) {
+        std::printf("failed to start the server on port %s\n", port.c_str());
+        return 1;
+    }
+
+    std::atomic<size_t> received(0);
+    std::vector<std::unique_ptr<hl::net::tcp_client>> clients;
+    for (size_t i = 0; i < CLIENTS; ++i) {
+        clients.emplace_back(new hl::net::tcp_client);
+        clients.back()->callbacks_register().set_on_receive([&received](hl::net::client_t, hl::net::shared_buffer_t, const size_t size) {
+            received += size;
+        });
+        clients.back()->connect("127.0.0.1", port);
+    }
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(ids_mutex);
+            if (ids.size() == CLIENTS) {
+                break;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    const hl::net::shared_buffer_t message = hl::net::make_shared_buffer(message_size);
+    for (const size_t producers : {1, 2, 4, 8, 16, 32}) {
+        const size_t base = received;
+        const auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> threads;
+        for (size_t p = 0; p < producers; ++p) {
+            threads.emplace_back([&, p]() {
+                for (size_t i = p; i < sends; i += producers) {
+                    server.send(ids[i % CLIENTS], message, message_size);
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        const auto enqueued = std::chrono::steady_clock::now();
+
+        while (received < base + sends * message_size && std::chrono::steady_clock::now() - enqueued < std::chrono::seconds(20)) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        const auto delivered = std::chrono::steady_clock::now();
+
+        std::printf("producers=%2zu: enqueue %.2f Msend/s, delivered %.2f Msend/s (%zu/%zu bytes)\n", producers,
+            sends / std::chrono::duration<double>(enqueued - start).count() / 1e6,
+            sends / std::chrono::duration<double>(delivered - start).count() / 1e6,
+            received - base, sends * message_size);
+    }
+
+    for (auto &client : clients) {
+        client->disconnect();
+    }
+    server.stop();
+    return 0;
+}
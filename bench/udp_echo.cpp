@@ -0,0 +1,202 @@
+#define HL_NET_LOG_LEVEL HL_NET_LOG_LEVEL_WARN
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include "HelNet.hpp"
+
+// Closed-loop udp echo: 8 raw peers each keep a window of 64-byte datagrams in flight and send a new one per echo,
+// so nothing is dropped and the echoed rate is the cost of the server. With --flood, datagrams from as many fresh
+// source ports follow the echo, which tells how much memory the server keeps per source.
+static const int PEERS = 8;
+static const size_t DATAGRAM_SIZE = 64;
+
+struct options final {
+    const char *port = nullptr;
+    int window = 32;
+    int seconds = 3;
+    size_t shards = 1; // SO_REUSEPORT sockets
+    size_t io_threads = 1; // per shard
+    size_t receives = 1; // kept in flight per socket
+    bool stateless = false;
+    size_t flood = 0; // datagrams, each from a fresh source port
+};
+
+static bool parse(const int argc, char **argv, options &parsed)
+{
+    if (argc < 2) {
+        return false;
+    }
+    parsed.port = argv[1];
+    for (int i = 2; i < argc; ++i) {
+        const bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--window") == 0 && has_value) {
+            parsed.window = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--seconds") == 0 && has_value) {
+            parsed.seconds = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--shards") == 0 && has_value) {
+            parsed.shards = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--io-threads") == 0 && has_value) {
+            parsed.io_threads = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--receives") == 0 && has_value) {
+            parsed.receives = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--stateless") == 0) {
+            parsed.stateless = true;
+        } else if (std::strcmp(argv[i], "--flood") == 0 && has_value) {
+            parsed.flood = std::strtoul(argv[++i], nullptr, 10);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static long rss_kib()
+{
+    std::ifstream status("/proc/self/status");
+    for (std::string line; std::getline(status, line);) {
+        if (line.compare(0, 6, "VmRSS:") == 0) {
+            return std::atol(line.c_str() + 6);
+        }
+    }
+    return 0;
+}
+
+// one datagram per new socket, paced so the server is not left too far behind: what is dropped here is not kept
+static void flood(const sockaddr_in &address, const size_t datagrams, const std::atomic<size_t> &received)
+{
+    static const size_t SOCKETS_OPEN = 500;
+    static const size_t MAX_BEHIND = 2000;
+
+    const size_t start_received = received;
+    std::vector<int> fds;
+    const char datagram[DATAGRAM_SIZE] = {};
+    for (size_t i = 0; i < datagrams; ++i) {
+        const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        sendto(fd, datagram, DATAGRAM_SIZE, 0, reinterpret_cast<const sockaddr *>(&address), sizeof(address));
+        fds.push_back(fd);
+        if (fds.size() == SOCKETS_OPEN) {
+            for (const int open_fd : fds) {
+                close(open_fd);
+            }
+            fds.clear();
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(50);
+            while (received - start_received + MAX_BEHIND < i && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    for (const int fd : fds) {
+        close(fd);
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (received - start_received < datagrams && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    options parsed;
+    if (!parse(argc, argv, parsed)) {
+        std::printf("%s: <port> [--window <datagrams in flight per peer = 32>] [--seconds <3>] [--shards <sockets = 1>] [--io-threads <per shard = 1>]\n"
+            "    [--receives <in flight per socket = 1>] [--stateless] [--flood <datagrams from fresh source ports = 0>]\n", argv[0]);
+        return 1;
+    }
+
+    hl::net::udp_server server;
+    server.set_io_threads(parsed.io_threads);
+    server.set_io_shards(parsed.shards);
+    server.set_udp_receives(parsed.receives);
+    server.set_stateless(parsed.stateless);
+    std::atomic<bool> echo(true);
+    std::atomic<size_t> received(0);
+    server.callbacks_register().set_on_receive([&echo, &received](hl::net::server_t, hl::net::connection_t client, hl::net::shared_buffer_t buffer, const size_t size) {
+        received++;
+        if (echo) {
+            client->send(buffer, size);
+        }
+    });
+    server.callbacks_register().set_on_datagram([&server, &echo, &received](hl::net::server_t, const boost::asio::ip::udp::endpoint &sender, hl::net::shared_buffer_t buffer, const size_t size) {
+        received++;
+        if (echo) {
+            server.send_to(sender, buffer, size);
+        }
+    });
+    if (server.start(parsed.port) == false) {
+        std::printf("failed to start the server on port %s\n", parsed.port);
+        return 1;
+    }
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(std::atoi(parsed.port)));
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+
+    std::atomic<bool> running(true);
+    std::atomic<size_t> echoed(0);
+    std::vector<std::thread> peers;
+    for (int p = 0; p < PEERS; ++p) {
+        peers.emplace_back([&]() {
+            const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+            connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address));
+            const timeval timeout{0, 20000};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            char datagram[DATAGRAM_SIZE] = {};
+            char reply[2048];
+            for (int i = 0; i < parsed.window; ++i) {
+                send(fd, datagram, DATAGRAM_SIZE, 0);
+            }
+            while (running) {
+                if (recv(fd, reply, sizeof(reply), 0) > 0) {
+                    echoed++;
+                    send(fd, datagram, DATAGRAM_SIZE, 0);
+                } else { // the window was lost, refill it
+                    for (int i = 0; i < parsed.window; ++i) {
+                        send(fd, datagram, DATAGRAM_SIZE, 0);
+                    }
+                }
+            }
+            close(fd);
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(300)); // warm up
+    const size_t start_echoed = echoed;
+    const auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds(parsed.seconds));
+    const size_t end_echoed = echoed;
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    running = false;
+    for (auto &peer : peers) {
+        peer.join();
+    }
+    std::printf("window=%d shards=%zu io_threads=%zu receives=%zu%s: %.0f echoed datagrams/s\n", parsed.window, parsed.shards,
+        parsed.io_threads, parsed.receives, parsed.stateless ? " stateless" : "",
+        static_cast<double>(end_echoed - start_echoed) / elapsed.count());
+
+    if (parsed.flood) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200)); // the last echoes
+        echo = false;
+        const long start_rss = rss_kib();
+        const size_t start_received = received;
+        flood(address, parsed.flood, received);
+        std::printf("flood of %zu source ports: %zu received, RSS %+ld KiB\n", parsed.flood, received - start_received,
+            rss_kib() - start_rss);
+    }
+    server.stop();
+    return 0;
+}
@@ -0,0 +1,85 @@
+#define HL_NET_LOG_LEVEL HL_NET_LOG_LEVEL_WARN
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "HelNet.hpp"
+
+// Udp segmentation offload: a client sends 1000-byte datagrams to a server for a few seconds, either one send per
+// datagram or 60000-byte sends split in 60 datagrams (UDP_SEGMENT on the client, UDP_GRO on the server). Built with
+// -DHL_NET_UDP_GSO_DISABLED, the 60000-byte sends are split by the library instead (the fallback).
+static const size_t DATAGRAM_SIZE = 1000;
+static const size_t SEGMENTS = 60;
+
+int main(int argc, char **argv)
+{
+    if (argc < 3 || (std::strcmp(argv[2], "single") != 0 && std::strcmp(argv[2], "gso") != 0)) {
+        std::printf("%s: <port> <single|gso> [seconds = 2]\n", argv[0]);
+        return 1;
+    }
+
+    const char *port = argv[1];
+    const bool gso = std::strcmp(argv[2], "gso") == 0;
+    const int seconds = argc > 3 ? std::atoi(argv[3]) : 2;
+    const size_t send_size = gso ? SEGMENTS * DATAGRAM_SIZE : DATAGRAM_SIZE;
+    const size_t datagrams_per_send = gso ? SEGMENTS : 1;
+    const long window = gso ? 4 : 240; // sends in flight, about the same bytes in both modes
+
+    std::atomic<size_t> received(0);
+    hl::net::udp_server server;
+    server.set_receive_mode(hl::net::receive_mode::copy);
+    server.set_udp_gro(gso);
+    server.callbacks_register().set_on_receive([&received](hl::net::server_t, hl::net::connection_t, hl::net::shared_buffer_t, const size_t) {
+        received++;
+    });
+    if (server.start(port) == false) {
+        std::printf("failed to start the server on port %s\n", port);
+        return 1;
+    }
+
+    std::atomic<long> in_flight(0);
+    hl::net::udp_client client;
+    if (gso) {
+        client.set_udp_segment_size(DATAGRAM_SIZE);
+    }
+    client.callbacks_register().set_on_sent([&in_flight](hl::net::client_t, const size_t) {
+        in_flight--;
+    });
+    client.callbacks_register().set_on_send_error([&in_flight](hl::net::client_t, const boost::system::error_code, const size_t) {
+        in_flight--;
+    });
+    if (client.connect("127.0.0.1", port) == false) {
+        std::printf("failed to connect to port %s\n", port);
+        return 1;
+    }
+
+    const hl::net::shared_buffer_t buffer = hl::net::make_shared_buffer(send_size);
+    size_t sent = 0;
+    const auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < std::chrono::seconds(seconds)) {
+        if (in_flight > window) {
+            std::this_thread::yield();
+            continue;
+        }
+        in_flight++;
+        client.send(buffer, send_size);
+        sent += datagrams_per_send;
+    }
+    const size_t end_received = received;
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    client.disconnect();
+    server.stop();
+
+#ifdef HL_NET_UDP_GSO_DISABLED
+    const char *mode = gso ? "60000-byte sends, library split" : "one send per datagram";
+#else
+    const char *mode = gso ? "60000-byte sends, GSO + GRO" : "one send per datagram";
+#endif
+    std::printf("%s: %.0f datagrams/s sent, %.0f datagrams/s received\n", mode,
+        static_cast<double>(sent) / elapsed.count(), static_cast<double>(end_received) / elapsed.count());
+    return 0;
+}
@@ -0,0 +1,114 @@
+#define HL_NET_LOG_LEVEL HL_NET_LOG_LEVEL_WARN
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include "HelNet.hpp"
+
+// Udp peer lookups: unordered_map with the previous endpoint hash against udp_peer_table, for 8 to 100000 peers;
+// then what a new peer costs: the endpoint strings, alias and name index built before against the binary keys
+using boost::asio::ip::udp;
+
+struct endpoint_hash final { // previous hash of the peers map
+    size_t operator()(const udp::endpoint &endpoint) const
+    {
+        size_t seed = std::hash<unsigned short>()(endpoint.port());
+        if (endpoint.address().is_v4()) {
+            seed ^= std::hash<unsigned long>()(endpoint.address().to_v4().to_ulong()) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        } else {
+            for (const unsigned char byte : endpoint.address().to_v6().to_bytes()) {
+                seed ^= std::hash<unsigned char>()(byte) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+            }
+        }
+        return seed;
+    }
+};
+
+static double elapsed_ns(const std::chrono::steady_clock::time_point &start, const size_t count)
+{
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / static_cast<double>(count);
+}
+
+static void lookups(const size_t peers)
+{
+    static const size_t LOOKUPS = 4000000;
+
+    std::mt19937 random(1);
+    std::vector<udp::endpoint> endpoints;
+    for (size_t i = 0; i < peers; ++i) {
+        endpoints.emplace_back(boost::asio::ip::address_v4(0x0a000000u + random() % 0xffffff), static_cast<unsigned short>(1024 + random() % 60000));
+    }
+    std::vector<udp::endpoint> looked_up;
+    for (size_t i = 0; i < LOOKUPS; ++i) {
+        looked_up.push_back(endpoints[random() % peers]);
+    }
+
+    std::unordered_map<udp::endpoint, hl::net::connection_t, endpoint_hash> map;
+    hl::net::udp_peer_table<hl::net::connection_t> table;
+    for (const udp::endpoint &endpoint : endpoints) {
+        map.emplace(endpoint, nullptr);
+        table.insert(hl::net::udp_peer_key(endpoint), nullptr);
+    }
+
+    size_t hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const udp::endpoint &endpoint : looked_up) {
+        hits += map.find(endpoint) != map.end();
+    }
+    const double map_ns = elapsed_ns(start, LOOKUPS);
+
+    start = std::chrono::steady_clock::now();
+    for (const udp::endpoint &endpoint : looked_up) {
+        hits += table.find(hl::net::udp_peer_key(endpoint)) != nullptr;
+    }
+    const double table_ns = elapsed_ns(start, LOOKUPS);
+
+    std::printf("peers=%6zu: unordered_map+endpoint_hash %5.1f ns/lookup, udp_peer_table %5.1f ns/lookup (%zu hits)\n",
+        peers, map_ns, table_ns, hits);
+}
+
+static void new_peers()
+{
+    static const unsigned PEERS = 200000;
+
+    std::vector<udp::endpoint> endpoints;
+    for (unsigned i = 0; i < PEERS; ++i) {
+        endpoints.emplace_back(boost::asio::ip::address_v4(0x0a000000u + i), static_cast<unsigned short>(1024 + i % 60000));
+    }
+
+    std::mutex mutex;
+    size_t sink = 0;
+    hl::net::utils::back_and_forth_unordered_map<std::string, hl::net::client_id_t> names;
+    auto start = std::chrono::steady_clock::now();
+    for (const udp::endpoint &endpoint : endpoints) {
+        const std::string name = hl::net::utils::endpoint_to_string(endpoint);
+        const std::string alias = fmt::format("udp_connection_unwrapped({})", hl::net::utils::endpoint_to_string(endpoint));
+        std::lock_guard<std::mutex> lock(mutex);
+        names.insert(name, sink++);
+        sink += alias.size();
+    }
+    const double strings_ns = elapsed_ns(start, PEERS);
+
+    hl::net::udp_peer_table<hl::net::client_id_t> ids;
+    start = std::chrono::steady_clock::now();
+    for (const udp::endpoint &endpoint : endpoints) {
+        const hl::net::udp_peer_key key(endpoint);
+        std::lock_guard<std::mutex> lock(mutex);
+        ids.insert(key, sink++);
+    }
+    const double keys_ns = elapsed_ns(start, PEERS);
+
+    std::printf("new peer: strings + name index %.1f ns, binary key + id index %.1f ns\n", strings_ns, keys_ns);
+}
+
+int main()
+{
+    for (const size_t peers : {8, 1000, 100000}) {
+        lookups(peers);
+    }
+    new_peers();
+    return 0;
+}
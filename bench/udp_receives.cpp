@@ -0,0 +1,75 @@
+#define HL_NET_LOG_LEVEL HL_NET_LOG_LEVEL_WARN
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include "HelNet.hpp"
+
+// Udp receives kept in flight against kernel drops: 4 io threads, 1 in 200 datagrams takes 2 ms in on_receive, while
+// 8 senders pace 64-byte datagrams at 200k per second in total
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        std::printf("%s: <port> <receives in flight>\n", argv[0]);
+        return 1;
+    }
+
+    static const int SENDERS = 8;
+    static const int DATAGRAMS_PER_SENDER = 50000;
+    static const int DATAGRAMS_PER_MS = 25; // per sender
+    const char *port = argv[1];
+    const size_t receives = std::strtoul(argv[2], nullptr, 10);
+
+    std::atomic<size_t> received(0);
+    hl::net::udp_server server;
+    server.set_io_threads(4);
+    server.set_udp_receives(receives);
+    server.callbacks_register().set_on_receive([&received](hl::net::server_t, hl::net::connection_t, hl::net::shared_buffer_t, const size_t) {
+        if (++received % 200 == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    });
+    if (server.start(port) == false) {
+        std::printf("failed to start the server on port %s\n", port);
+        return 1;
+    }
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(std::atoi(port)));
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+
+    std::atomic<size_t> sent(0);
+    std::vector<std::thread> senders;
+    for (int s = 0; s < SENDERS; ++s) {
+        senders.emplace_back([&]() {
+            const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+            const char datagram[64] = {};
+            const auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < DATAGRAMS_PER_SENDER; ++i) {
+                sendto(fd, datagram, sizeof(datagram), 0, reinterpret_cast<const sockaddr *>(&address), sizeof(address));
+                sent++;
+                if (i % DATAGRAMS_PER_MS == DATAGRAMS_PER_MS - 1) {
+                    std::this_thread::sleep_until(start + std::chrono::microseconds(1000 * (i + 1) / DATAGRAMS_PER_MS));
+                }
+            }
+            close(fd);
+        });
+    }
+    for (auto &sender : senders) {
+        sender.join();
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(2)); // drain
+
+    std::printf("receives=%zu: sent %zu, received %zu, dropped %lu\n", receives, sent.load(), received.load(),
+        static_cast<unsigned long>(server.get_udp_receive_drops()));
+    server.stop();
+    return 0;
+}
@@ -0,0 +1,77 @@
+#define HL_NET_LOG_LEVEL HL_NET_LOG_LEVEL_WARN
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include "HelNet.hpp"
+
+// Udp peers spread over the SO_REUSEPORT sockets of the io shards, and a disconnected peer comes back on its next datagram
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        std::printf("%s: <port> [peers = 16] [io shards = 4]\n", argv[0]);
+        return 1;
+    }
+
+    const std::string port = argv[1];
+    const size_t peers = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 16;
+    const size_t shards = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 4;
+
+    std::atomic<size_t> connections(0);
+    std::mutex threads_mutex;
+    std::set<std::thread::id> threads; // with 1 io thread per shard, a thread stands for a socket
+    hl::net::client_id_t first = hl::net::INVALID_CLIENT_ID;
+
+    hl::net::udp_server server;
+    server.set_io_threads(1);
+    server.set_io_shards(shards);
+    server.callbacks_register().set_on_connection([&](hl::net::server_t, hl::net::connection_t client) {
+        std::lock_guard<std::mutex> lock(threads_mutex);
+        if (connections++ == 0) {
+            first = client->get_id();
+        }
+    });
+    server.callbacks_register().set_on_receive([&](hl::net::server_t, hl::net::connection_t, hl::net::shared_buffer_t, const size_t) {
+        std::lock_guard<std::mutex> lock(threads_mutex);
+        threads.insert(std::this_thread::get_id());
+    });
+    if (server.start(port) == false) {
+        std::printf("failed to start the server on port %s\n", port.c_str());
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<hl::net::udp_client>> clients;
+    for (size_t i = 0; i < peers; ++i) {
+        clients.emplace_back(new hl::net::udp_client);
+        clients.back()->connect("127.0.0.1", port);
+        clients.back()->send_string("hello");
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    const size_t before = connections;
+
+    hl::net::client_id_t disconnected;
+    {
+        std::lock_guard<std::mutex> lock(threads_mutex);
+        disconnected = first;
+    }
+    server.disconnect(disconnected);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    for (auto &client : clients) {
+        client->send_string("again");
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    for (auto &client : clients) {
+        client->disconnect();
+    }
+    server.stop();
+
+    std::printf("peers=%zu connections=%zu served by %zu sockets, after disconnecting one: connections=%zu\n",
+        peers, before, threads.size(), connections.load());
+    return before == peers && connections == peers + 1 ? 0 : 1;
+}
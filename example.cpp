@@ -86,9 +86,7 @@ void server_routine(const std::string& port)
     if (std::is_same<Protocol, hl::net::udp_server>::value) {
         server.template attach_plugin<hl::net::plugins::server_clients_timeout>(2000); // 2000ms
     }
-    while (server.update()) { 
-        // std::this_thread::sleep_for(std::chrono::seconds(1));
-    }
+    server.run_until_stopped();
     HL_NET_LOG_CRITICAL("Server closed");
 }
 